@@ -0,0 +1,50 @@
+#ifndef OBJECT_RECOGNITION_ATOMIC_VALUE_H
+#define OBJECT_RECOGNITION_ATOMIC_VALUE_H
+
+#include <boost/noncopyable.hpp>
+
+//Integer, bool or pointer that several threads can use without a lock, on the
+//__sync builtins of GCC. boost::atomic needs Boost 1.53, Hydro ships 1.46 / 1.48.
+//Every operation is a full barrier.
+template <typename T> class atomic_value : boost::noncopyable {
+public:
+    explicit atomic_value(T value = T()) : value_(value) {}
+
+    T load() const {
+        return __sync_val_compare_and_swap(&value_, T(), T());
+    }
+
+    void store(T value) {
+        exchange(value);
+    }
+
+    //Sets value and returns the one before
+    T exchange(T value) {
+        T expected = value_;
+        T seen;
+        while((seen = __sync_val_compare_and_swap(&value_, expected, value)) != expected) {
+            expected = seen;
+        }
+        return expected;
+    }
+
+    //Integers only, returns the value before
+    T fetch_add(T n) {
+        return __sync_fetch_and_add(&value_, n);
+    }
+
+    //Sets desired if the value is expected, otherwise expected gets the value
+    bool compare_exchange(T& expected, T desired) {
+        const T seen = __sync_val_compare_and_swap(&value_, expected, desired);
+        if(seen == expected) {
+            return true;
+        }
+        expected = seen;
+        return false;
+    }
+
+private:
+    mutable volatile T value_;
+};
+
+#endif
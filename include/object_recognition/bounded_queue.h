@@ -0,0 +1,81 @@
+#ifndef OBJECT_RECOGNITION_BOUNDED_QUEUE_H
+#define OBJECT_RECOGNITION_BOUNDED_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+//FIFO between producers and a pool of consumers that holds at most capacity
+//items. A producer never waits: when the queue is full the oldest item is
+//dropped and handed back, so the consumers always work on the latest items.
+template <typename T> class bounded_queue : boost::noncopyable {
+public:
+    explicit bounded_queue(size_t capacity) :
+        capacity_(capacity > 0 ? capacity : 1),
+        closed_(false)
+    {
+    }
+
+    //Returns true if the queue was full and the oldest item was moved to dropped.
+    //Items pushed after close() are handed back as dropped.
+    bool push(const T& item, T& dropped) {
+        bool full;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if(closed_) {
+                dropped = item;
+                return true;
+            }
+            full = items_.size() >= capacity_;
+            if(full) {
+                dropped = items_.front();
+                items_.pop_front();
+            }
+            items_.push_back(item);
+        }
+        itemAvailable_.notify_one();
+        return full;
+    }
+
+    //Waits for the oldest item, false once the queue is closed
+    bool pop(T& item) {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(items_.empty() && !closed_) {
+            itemAvailable_.wait(lock);
+        }
+        if(closed_) {
+            return false;
+        }
+        item = items_.front();
+        items_.pop_front();
+        return true;
+    }
+
+    //Wakes up all consumers, the items still queued are discarded
+    void close() {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            closed_ = true;
+            items_.clear();
+        }
+        itemAvailable_.notify_all();
+    }
+
+    size_t size() const {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    const size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable itemAvailable_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef OBJECT_RECOGNITION_CLOUD_VIEW_H
+#define OBJECT_RECOGNITION_CLOUD_VIEW_H
+
+#include <opencv2/core/core.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+//Non owning view of an organized point buffer with float x, y, z and a packed
+//bgra color per point. This is the layout of the clouds the openni driver
+//publishes, so the data of a sensor_msgs::PointCloud2 can be used in place,
+//and it is also the layout of pcl::PointXYZRGB.
+//Whoever creates the view has to keep the buffer alive.
+struct organized_cloud_view {
+    organized_cloud_view() :
+        data(NULL), width(0), height(0),
+        pointStep(0), rowStep(0), xyzOffset(0), rgbOffset(0)
+    {
+    }
+
+    organized_cloud_view(const unsigned char* data, int width, int height,
+                         int pointStep, int rowStep, int xyzOffset, int rgbOffset) :
+        data(data), width(width), height(height),
+        pointStep(pointStep), rowStep(rowStep), xyzOffset(xyzOffset), rgbOffset(rgbOffset)
+    {
+    }
+
+    //View of a pcl cloud, e.g. for tests and benchmarks
+    explicit organized_cloud_view(const pcl::PointCloud<pcl::PointXYZRGB>& cloud) :
+        data(reinterpret_cast<const unsigned char*>(&cloud.points[0])),
+        width(cloud.width), height(cloud.height),
+        pointStep(sizeof(pcl::PointXYZRGB)), rowStep(cloud.width*sizeof(pcl::PointXYZRGB)),
+        xyzOffset(pclXyzOffset()), rgbOffset(pclRgbOffset())
+    {
+    }
+
+    bool empty() const { return data == NULL || width == 0 || height == 0; }
+
+    //x, y, z of the point in the given column and row
+    const float* xyz(int col, int row) const {
+        return reinterpret_cast<const float*>(data + row*rowStep + col*pointStep + xyzOffset);
+    }
+
+    //First point of a row, the next one is pointStep bytes further
+    const unsigned char* row(int row) const {
+        return data + row*rowStep;
+    }
+
+    //Deinterleaves the color into a bgr8 image in one pass.
+    //Every point is treated as one pointStep channel pixel and mixChannels
+    //picks the b, g, r bytes out of it.
+    void bgrImage(cv::Mat& out) const {
+        out.create(height, width, CV_8UC3);
+        cv::Mat points(height, width, CV_8UC(pointStep), const_cast<unsigned char*>(data), rowStep);
+        const int fromTo[] = { rgbOffset, 0, rgbOffset + 1, 1, rgbOffset + 2, 2 };
+        cv::mixChannels(&points, 1, &out, 1, fromTo, 3);
+    }
+
+    const unsigned char* data;
+    int width, height;
+    int pointStep, rowStep;
+    int xyzOffset, rgbOffset;
+
+private:
+    //offsetof is not allowed on the pcl point types, they are not PODs
+    static int pclXyzOffset() {
+        pcl::PointXYZRGB p;
+        return reinterpret_cast<const char*>(&p.x) - reinterpret_cast<const char*>(&p);
+    }
+    static int pclRgbOffset() {
+        pcl::PointXYZRGB p;
+        return reinterpret_cast<const char*>(&p.rgb) - reinterpret_cast<const char*>(&p);
+    }
+};
+
+#endif
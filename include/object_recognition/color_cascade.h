@@ -0,0 +1,79 @@
+#ifndef OBJECT_RECOGNITION_COLOR_CASCADE_H
+#define OBJECT_RECOGNITION_COLOR_CASCADE_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+struct cascade_params {
+    cascade_params() :
+        enabled(false),
+        hueBins(18), saturationBins(4),
+        minSaturation(60),
+        shapeWeight(0.25f),
+        acceptDistance(0.5f),
+        margin(1.5f)
+    {
+    }
+
+    //Without the cascade every crop goes through the PCA and the KNN search. Off
+    //until recognition_benchmark shows the accept distance and margin cost no accuracy.
+    bool enabled;
+    //Bins of the hue / saturation histogram
+    int hueBins, saturationBins;
+    //Pixels below this saturation are background, they are left out of the
+    //histogram and make up the shape mask
+    int minSaturation;
+    //Weight of the shape moments against the histogram in the distance
+    float shapeWeight;
+    //A crop this close to a prototype is taken as its class...
+    float acceptDistance;
+    //...if the prototype of every other class is at least margin times farther
+    float margin;
+};
+
+//First stage of the classification: a compact hue / saturation histogram and
+//the moments of the colored area of a crop, scored against the mean of every
+//class. It only answers when one class is clearly the nearest, everything
+//else is left to the PCA and the KNN search.
+//Distances are L1, the histogram part is in [0, 2].
+class color_cascade {
+public:
+    explicit color_cascade(const cascade_params& params = cascade_params()) : params_(params) {}
+
+    void configure(const cascade_params& params) { params_ = params; prototypes_.release(); counts_.clear(); }
+    const cascade_params& params() const { return params_; }
+
+    //Floats features() writes
+    int featureLength() const { return params_.hueBins * params_.saturationBins + shapeFeatures; }
+    //Features of an HSV crop, blurred like the training images
+    void features(const cv::Mat& hsvSample, float* out) const;
+
+    //Prototype of label i is the mean of the features of its samples, row i of
+    //the result. Labels without samples get a row of zeros and are never matched.
+    cv::Mat prototypes(const cv::Mat& features, const std::vector<int>& labels, int classes) const;
+    //Takes the prototypes over, counts are the samples of every class of labels
+    void setPrototypes(const cv::Mat& prototypes, const std::vector<int>& labels);
+    const cv::Mat& prototypes() const { return prototypes_; }
+    //Moves the prototype of label towards one more sample, a new label gets its own
+    void add(int label, const float* feature);
+
+    //Nearest class among those allowed, -1 if it is not clearly the nearest.
+    //allowed[i] says whether label i may be answered, empty allows all. The
+    //classes that are not allowed still count for the margin. confidence is
+    //1 - distance / d(second nearest class), with a single class the second
+    //distance is margin * acceptDistance.
+    int match(const float* feature, const std::vector<char>& allowed, float& distance, float& confidence) const;
+
+    //Fill ratio and the first two Hu moments of the colored area
+    static const int shapeFeatures = 3;
+
+private:
+    float distance(const float* a, const float* b) const;
+
+    cascade_params params_;
+    //CV_32FC1, one row per label
+    cv::Mat prototypes_;
+    std::vector<int> counts_;
+};
+
+#endif
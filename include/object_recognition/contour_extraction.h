@@ -0,0 +1,111 @@
+#ifndef OBJECT_RECOGNITION_CONTOUR_EXTRACTION_H
+#define OBJECT_RECOGNITION_CONTOUR_EXTRACTION_H
+
+#include <vector>
+#include <climits>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <object_recognition/cloud_view.h>
+
+//Collects the points of an organized cloud that lie inside a contour.
+//The contour is rasterized once into a mask that only covers its bounding rect,
+//so the cost grows with the object area instead of pixels * contour length.
+//NaN points are dropped and the centroid is accumulated in the same pass.
+class contour_extractor {
+public:
+    contour_extractor() :
+        contours_(1),
+        totalPoints_(0),
+        validPoints_(0)
+    {
+        centroid_.setZero();
+    }
+
+    //Returns the number of finite points inside the contour.
+    //The centroid is moved into the target frame with transform.
+    size_t extract(const std::vector<cv::Point>& contour, const organized_cloud_view& cloud,
+                   const Eigen::Affine3f& transform = Eigen::Affine3f::Identity()) {
+        totalPoints_ = 0;
+        validPoints_ = 0;
+        centroid_.setZero();
+
+        bounds_ = cv::Rect();
+        if(contour.empty()) {
+            return 0;
+        }
+        bounds_ = cv::boundingRect(contour) & cv::Rect(0, 0, cloud.width, cloud.height);
+        if(bounds_.area() == 0) {
+            return 0;
+        }
+
+        rasterize(contour);
+
+        Eigen::Vector3d sum(0, 0, 0);
+        for(int r = 0; r < bounds_.height; ++r) {
+            const unsigned char* maskRow = mask_.ptr<unsigned char>(r);
+            const unsigned char* point = reinterpret_cast<const unsigned char*>(cloud.xyz(bounds_.x, bounds_.y + r));
+            for(int c = 0; c < bounds_.width; ++c, point += cloud.pointStep) {
+                if(!maskRow[c]) {
+                    continue;
+                }
+                ++totalPoints_;
+                const float* p = reinterpret_cast<const float*>(point);
+                if(!pcl_isfinite(p[0]) || !pcl_isfinite(p[1]) || !pcl_isfinite(p[2])) {
+                    continue;
+                }
+                ++validPoints_;
+                sum[0] += p[0];
+                sum[1] += p[1];
+                sum[2] += p[2];
+            }
+        }
+
+        //The transform is affine, so moving the mean is the same as moving every point
+        if(validPoints_ > 0) {
+            sum /= double(validPoints_);
+            const Eigen::Vector3f center = transform * sum.cast<float>();
+            centroid_ << center[0], center[1], center[2], 1.0f;
+        }
+        return validPoints_;
+    }
+
+    //Centroid of the finite points of the last extraction
+    const Eigen::Vector4f& centroid() const { return centroid_; }
+    //Number of pixels inside the contour, including NaN points
+    size_t totalPoints() const { return totalPoints_; }
+    size_t validPoints() const { return validPoints_; }
+    //Bounding rect of the last contour, clipped to the cloud
+    const cv::Rect& bounds() const { return bounds_; }
+    //Mask of the last contour, relative to bounds()
+    const cv::Mat& mask() const { return mask_; }
+
+private:
+    void rasterize(const std::vector<cv::Point>& contour) {
+        //Grow the buffer only when a bigger contour comes along
+        if(buffer_.rows < bounds_.height || buffer_.cols < bounds_.width) {
+            buffer_.create(std::max(buffer_.rows, bounds_.height), std::max(buffer_.cols, bounds_.width), CV_8UC1);
+        }
+        mask_ = buffer_(cv::Rect(0, 0, bounds_.width, bounds_.height));
+        mask_.setTo(0);
+
+        //The outline is drawn as well so border pixels count as inside, like pointPolygonTest(...) >= 0
+        contours_[0].assign(contour.begin(), contour.end());
+        cv::Point offset(-bounds_.x, -bounds_.y);
+        cv::drawContours(mask_, contours_, 0, cv::Scalar(255), CV_FILLED, 8, cv::noArray(), INT_MAX, offset);
+        cv::drawContours(mask_, contours_, 0, cv::Scalar(255), 1, 8, cv::noArray(), INT_MAX, offset);
+    }
+
+    std::vector<std::vector<cv::Point> > contours_;
+    cv::Mat buffer_;
+    cv::Mat mask_;
+    cv::Rect bounds_;
+    Eigen::Vector4f centroid_;
+    size_t totalPoints_;
+    size_t validPoints_;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef OBJECT_RECOGNITION_DECISION_ENGINE_H
+#define OBJECT_RECOGNITION_DECISION_ENGINE_H
+
+#include <string>
+#include <deque>
+#include <object_recognition/object_classifier.h>
+
+struct decision_params {
+    decision_params() :
+        type("confidence"),
+        confirmations(3),
+        window(5),
+        minVotes(0.5f),
+        confirmConfidence(0.8f),
+        agreement(0.6f)
+    {
+    }
+
+    //"consecutive" decides after confirmations equal labels in a row, the way the
+    //node used to. "confidence" weighs every frame by its votes and distances.
+    std::string type;
+    int confirmations;
+    //Frames the confidence is summed over
+    int window;
+    //Frames where fewer than this share of the neighbors voted for the label are noise
+    float minVotes;
+    //Summed confidence of a label that decides it, one clear frame can reach it
+    float confirmConfidence;
+    //Share of the window's confidence the decided label needs
+    float agreement;
+};
+
+//What the engine decided and how long it took since the last reset()
+struct decision {
+    decision() : label(-1), confidence(0), frames(0), firstTime(0) {}
+
+    int label;
+    float confidence;
+    //Frames added until the decision
+    int frames;
+    //Time of the first frame, in the unit add() got it
+    double firstTime;
+};
+
+//Temporal fusion of the classifications of consecutive crops of one object.
+//Every crop is added with the label it was classified as, the engine decides
+//when the evidence is strong enough.
+class decision_engine {
+public:
+    virtual ~decision_engine() {}
+
+    //Adds one frame, true if it decided. label -1 is a valid label for "unknown".
+    //The confidence of result is that of result.label. A frame added with another
+    //label, like -1 when the color of the detection contradicts the classified
+    //name, has zero confidence: "confidence" takes it as noise and never decides
+    //on it, "consecutive" still decides after enough of them in a row.
+    virtual bool add(int label, const classification_result& result, double time, decision& decided) = 0;
+    //Forgets all frames, like after a decision or for a new object
+    virtual void reset() = 0;
+
+    //NULL for an unknown type, the caller owns the engine
+    static decision_engine* create(const decision_params& params);
+};
+
+//Confidence of a single classification in [0, 1]: the share of the neighbors
+//that voted for the label times the margin to the nearest neighbor of another
+//label, 1 - d(label) / d(other) on the unsquared distances. 1 if all neighbors agree.
+//For an answer of the color cascade its cascadeConfidence, the same margin on the
+//prototype distances.
+float classificationConfidence(const classification_result& result);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef OBJECT_RECOGNITION_DEPTH_CROP_H
+#define OBJECT_RECOGNITION_DEPTH_CROP_H
+
+#include <cstring>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <object_recognition/cloud_view.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//Builds both depth masks of object_detection in one pass over the cloud.
+//  included: point inside the crop box or without depth (NaN)
+//  excluded: point inside the crop box
+//Only pixels inside the region of interest are tested, everything else is 0.
+//The points are moved into the frame of the crop box on the fly, so the cloud
+//itself never has to be transformed or copied.
+//The masks are written directly, nothing is allocated once their size is known.
+class depth_crop_filter {
+public:
+    depth_crop_filter() :
+        boxMin_(-10, -10, -10, 0),
+        boxMax_(10, 10, 10, 0),
+        roi_(0, 0, 0, 0)
+    {
+    }
+
+    //Crop box in the frame of the cloud, the 4th component is ignored
+    void setBox(const Eigen::Vector4f& boxMin, const Eigen::Vector4f& boxMax) {
+        boxMin_ = boxMin;
+        boxMax_ = boxMax;
+    }
+
+    //Region of interest in pixels. A width or height <= 0 extends it to the image border.
+    void setRoi(const cv::Rect& roi) {
+        roi_ = roi;
+    }
+
+    //The roi clipped to an image of the given size
+    cv::Rect roi(int rows, int cols) const {
+        cv::Rect r = roi_;
+        if(r.width <= 0) r.width = cols - r.x;
+        if(r.height <= 0) r.height = rows - r.y;
+        return r & cv::Rect(0, 0, cols, rows);
+    }
+
+    //transform maps the points of the cloud into the frame of the crop box
+    void apply(const organized_cloud_view& cloud, const Eigen::Affine3f& transform,
+               cv::Mat& included, cv::Mat& excluded) const {
+        apply(cloud, transform, cv::Rect(0, 0, cloud.width, cloud.height), included, excluded);
+    }
+
+    //Masks for a part of the image only, pixel (0, 0) of the masks is region.tl().
+    //With step > 1 only every step-th point in each direction is tested and the
+    //masks are smaller by that factor, for segmenting downsampled images.
+    void apply(const organized_cloud_view& cloud, const Eigen::Affine3f& transform, const cv::Rect& region,
+               cv::Mat& included, cv::Mat& excluded, int step = 1) const {
+        const int maskRows = (region.height + step - 1) / step;
+        const int maskCols = (region.width + step - 1) / step;
+        included.create(maskRows, maskCols, CV_8UC1);
+        excluded.create(maskRows, maskCols, CV_8UC1);
+
+        //Mask columns [left, right) fall into the roi
+        const cv::Rect r = roi(cloud.height, cloud.width) & region;
+        const int left = std::min(maskCols, (r.x - region.x + step - 1) / step);
+        const int right = std::max(left, std::min(maskCols, (r.x + r.width - region.x + step - 1) / step));
+        for(int y = 0; y < maskRows; ++y) {
+            unsigned char* inc = included.ptr<unsigned char>(y);
+            unsigned char* exc = excluded.ptr<unsigned char>(y);
+            const int imageRow = region.y + y*step;
+            if(r.area() == 0 || imageRow < r.y || imageRow >= r.y + r.height) {
+                std::memset(inc, 0, maskCols);
+                std::memset(exc, 0, maskCols);
+                continue;
+            }
+            std::memset(inc, 0, left);
+            std::memset(exc, 0, left);
+            std::memset(inc + right, 0, maskCols - right);
+            std::memset(exc + right, 0, maskCols - right);
+            if(right > left) {
+                cropRow(cloud.xyz(region.x + left*step, imageRow), cloud.pointStep*step, transform,
+                        right - left, inc + left, exc + left);
+            }
+        }
+    }
+
+private:
+#ifdef __SSE2__
+    //x, y and z of a point sit in one 16 byte block, so they map onto three lanes
+    //of an SSE register. The transform is three multiply-adds with the broadcast
+    //coordinates and the box test two compares.
+    void cropRow(const float* first, int stride, const Eigen::Affine3f& transform,
+                 int count, unsigned char* inc, unsigned char* exc) const {
+        const Eigen::Matrix4f& m = transform.matrix();
+        const __m128 c0 = _mm_setr_ps(m(0,0), m(1,0), m(2,0), 0.0f);
+        const __m128 c1 = _mm_setr_ps(m(0,1), m(1,1), m(2,1), 0.0f);
+        const __m128 c2 = _mm_setr_ps(m(0,2), m(1,2), m(2,2), 0.0f);
+        const __m128 t = _mm_setr_ps(m(0,3), m(1,3), m(2,3), 0.0f);
+        const __m128 lo = _mm_setr_ps(boxMin_[0], boxMin_[1], boxMin_[2], 0.0f);
+        const __m128 hi = _mm_setr_ps(boxMax_[0], boxMax_[1], boxMax_[2], 0.0f);
+        const unsigned char* point = reinterpret_cast<const unsigned char*>(first);
+        for(int i = 0; i < count; ++i, point += stride) {
+            const __m128 p = _mm_loadu_ps(reinterpret_cast<const float*>(point));
+            __m128 q = _mm_add_ps(t, _mm_mul_ps(c0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0,0,0,0))));
+            q = _mm_add_ps(q, _mm_mul_ps(c1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1))));
+            q = _mm_add_ps(q, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2))));
+            const int inBox = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(q, lo), _mm_cmple_ps(q, hi))) & 7;
+            const int invalid = _mm_movemask_ps(_mm_cmpunord_ps(p, p)) & 1;
+            exc[i] = inBox == 7 ? 255 : 0;
+            inc[i] = (inBox == 7 || invalid) ? 255 : 0;
+        }
+    }
+#else
+    void cropRow(const float* first, int stride, const Eigen::Affine3f& transform,
+                 int count, unsigned char* inc, unsigned char* exc) const {
+        const unsigned char* point = reinterpret_cast<const unsigned char*>(first);
+        for(int i = 0; i < count; ++i, point += stride) {
+            const float* p = reinterpret_cast<const float*>(point);
+            const Eigen::Vector3f cp = transform * Eigen::Vector3f(p[0], p[1], p[2]);
+            const bool inBox =
+                    cp[0] >= boxMin_[0] && cp[0] <= boxMax_[0] &&
+                    cp[1] >= boxMin_[1] && cp[1] <= boxMax_[1] &&
+                    cp[2] >= boxMin_[2] && cp[2] <= boxMax_[2];
+            exc[i] = inBox ? 255 : 0;
+            inc[i] = (inBox || p[0] != p[0]) ? 255 : 0;
+        }
+    }
+#endif
+
+    Eigen::Vector4f boxMin_, boxMax_;
+    cv::Rect roi_;
+};
+
+#endif
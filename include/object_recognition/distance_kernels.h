@@ -0,0 +1,30 @@
+#ifndef OBJECT_RECOGNITION_DISTANCE_KERNELS_H
+#define OBJECT_RECOGNITION_DISTANCE_KERNELS_H
+
+#include <string>
+
+#include <cstddef>
+
+//Kernels of the PCA projection and the neighbor search. The implementation is
+//picked once at startup from what the CPU supports: AVX2 + FMA if the library
+//was built with them, otherwise SSE2, otherwise plain C++.
+
+//Squared L2 distance of two float rows
+float squaredDistance(const float* a, const float* b, int n);
+
+//Squared L2 distance of a float row to an int8 row, where dimension i of the
+//int8 row stands for codes[i] * scale[i]
+float squaredDistanceQuantized(const float* a, const signed char* codes, const float* scale, int n);
+
+//out[r] is the dot product of x with rows + r * step for r < count, all of length n.
+//Four rows are done at once, so x is read once per four rows.
+void dotProducts(const float* x, const float* rows, size_t step, int count, int n, float* out);
+
+//"avx2", "sse2" or "scalar"
+const char* distanceKernel();
+
+//Forces a kernel, e.g. to compare them in a benchmark.
+//Returns false if it is not available on this machine or build.
+bool setDistanceKernel(const std::string& name);
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef OBJECT_RECOGNITION_HSV_LABELING_H
+#define OBJECT_RECOGNITION_HSV_LABELING_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+//Labels a whole HSV frame against all color ranges in one pass.
+//Every range is an axis aligned box in HSV space, so it is compiled into three
+//per channel lookup tables of class bitmasks. A pixel is in range i when bit i is
+//set in H[h] & S[s] & V[v]; inverted ranges are flipped with one xor afterwards.
+//The depth masks are folded in the same pass, so the label image already holds
+//what used to be inRange + bitwise_not + (HSVmask & depthMask) for every range.
+class hsv_label_table {
+public:
+    typedef unsigned int label_t;
+    static const int maxClasses = 32;
+
+    hsv_label_table() :
+        classCount_(0),
+        invertedMask_(0),
+        includeInvalidMask_(0),
+        presentMask_(0)
+    {
+        clearTables();
+    }
+
+    //Compiles the ranges into the lookup tables. Range needs the min, max, inverted
+    //and includeInvalid members of object_detection's hsvRange.
+    //Returns false if there are more ranges than label bits, the rest are ignored.
+    template <typename Range> bool compile(const std::vector<Range>& ranges) {
+        clearTables();
+        invertedMask_ = 0;
+        includeInvalidMask_ = 0;
+        classCount_ = std::min<int>(ranges.size(), maxClasses);
+
+        for(int i = 0; i < classCount_; ++i) {
+            const label_t bit = label_t(1) << i;
+            setRange(hTable_, ranges[i].min[0], ranges[i].max[0], bit);
+            setRange(sTable_, ranges[i].min[1], ranges[i].max[1], bit);
+            setRange(vTable_, ranges[i].min[2], ranges[i].max[2], bit);
+            if(ranges[i].inverted) {
+                invertedMask_ |= bit;
+            }
+            if(ranges[i].includeInvalid) {
+                includeInvalidMask_ |= bit;
+            }
+        }
+        return int(ranges.size()) <= maxClasses;
+    }
+
+    //Labels an 8 bit HSV image. Ranges with includeInvalid are combined with
+    //depthIncluded, all others with depthExcluded.
+    void label(const cv::Mat& hsv, const cv::Mat& depthIncluded, const cv::Mat& depthExcluded) {
+        CV_Assert(hsv.type() == CV_8UC3);
+        CV_Assert(depthIncluded.size() == hsv.size() && depthExcluded.size() == hsv.size());
+
+        labels_.create(hsv.size(), CV_32SC1);
+        rowMask_.resize(hsv.rows);
+        const label_t classMask = classCount_ == maxClasses ? ~label_t(0) : (label_t(1) << classCount_) - 1;
+        const label_t excludeMask = ~includeInvalidMask_ & classMask;
+        const label_t inverted = invertedMask_ & classMask;
+
+        presentMask_ = 0;
+        for(int r = 0; r < hsv.rows; ++r) {
+            const unsigned char* pixel = hsv.ptr<unsigned char>(r);
+            const unsigned char* included = depthIncluded.ptr<unsigned char>(r);
+            const unsigned char* excluded = depthExcluded.ptr<unsigned char>(r);
+            label_t* out = labels_.ptr<label_t>(r);
+            label_t rowPresent = 0;
+            for(int c = 0; c < hsv.cols; ++c, pixel += 3) {
+                label_t inRange = (hTable_[pixel[0]] & sTable_[pixel[1]] & vTable_[pixel[2]]) ^ inverted;
+                label_t depth = (included[c] ? includeInvalidMask_ : 0) | (excluded[c] ? excludeMask : 0);
+                out[c] = inRange & depth;
+                rowPresent |= out[c];
+            }
+            rowMask_[r] = rowPresent;
+            presentMask_ |= rowPresent;
+        }
+    }
+
+    //True if any pixel of the last labeled frame belongs to class i
+    bool present(int i) const { return (presentMask_ >> i) & 1; }
+
+    //Binary 0/255 mask of class i, e.g. for findContours.
+    //Rows without a pixel of that class are only cleared.
+    void classMask(int i, cv::Mat& mask) const {
+        mask.create(labels_.size(), CV_8UC1);
+        const label_t bit = label_t(1) << i;
+        for(int r = 0; r < labels_.rows; ++r) {
+            unsigned char* out = mask.ptr<unsigned char>(r);
+            if(!(rowMask_[r] & bit)) {
+                std::memset(out, 0, labels_.cols);
+                continue;
+            }
+            const label_t* in = labels_.ptr<label_t>(r);
+            for(int c = 0; c < labels_.cols; ++c) {
+                out[c] = (in[c] & bit) ? 255 : 0;
+            }
+        }
+    }
+
+    //Label image of the last frame, one bit per class
+    const cv::Mat& labels() const { return labels_; }
+    int classCount() const { return classCount_; }
+
+private:
+    void clearTables() {
+        std::fill(hTable_, hTable_ + 256, label_t(0));
+        std::fill(sTable_, sTable_ + 256, label_t(0));
+        std::fill(vTable_, vTable_ + 256, label_t(0));
+    }
+
+    //Same bounds handling as cv::inRange on 8 bit images
+    static void setRange(label_t* table, double lower, double upper, label_t bit) {
+        int lo = cv::saturate_cast<unsigned char>(lower);
+        int hi = cv::saturate_cast<unsigned char>(upper);
+        for(int v = lo; v <= hi; ++v) {
+            table[v] |= bit;
+        }
+    }
+
+    label_t hTable_[256];
+    label_t sTable_[256];
+    label_t vTable_[256];
+    int classCount_;
+    label_t invertedMask_;
+    label_t includeInvalidMask_;
+    label_t presentMask_;
+    std::vector<label_t> rowMask_;
+    cv::Mat labels_;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef OBJECT_RECOGNITION_LATEST_MAILBOX_H
+#define OBJECT_RECOGNITION_LATEST_MAILBOX_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <object_recognition/atomic_value.h>
+
+//Single slot mailbox between one producer and one consumer where the latest item wins.
+//put() and take() are a single atomic exchange of the slot, so the producer never
+//waits for the consumer. An item that is replaced before it was taken is deleted
+//and counted as dropped. The mutex is only used to let the consumer sleep.
+template <typename T> class latest_mailbox : boost::noncopyable {
+public:
+    latest_mailbox() :
+        slot_(NULL),
+        dropped_(0)
+    {
+    }
+
+    ~latest_mailbox() {
+        delete slot_.exchange(NULL);
+    }
+
+    //Takes ownership of item, returns true if it replaced one nobody took
+    bool put(T* item) {
+        T* old = slot_.exchange(item);
+        if(old) {
+            delete old;
+            dropped_.fetch_add(1);
+        }
+        //Taking the lock makes sure a consumer between its check and its wait gets the notify
+        { boost::lock_guard<boost::mutex> lock(waitMutex_); }
+        itemAvailable_.notify_one();
+        return old != NULL;
+    }
+
+    //Returns the latest item or NULL, the caller owns it
+    T* take() {
+        return slot_.exchange(NULL);
+    }
+
+    //Like take(), but waits up to timeout for an item
+    T* waitTake(const boost::posix_time::time_duration& timeout) {
+        T* item = take();
+        if(item) {
+            return item;
+        }
+        boost::unique_lock<boost::mutex> lock(waitMutex_);
+        const boost::system_time deadline = boost::get_system_time() + timeout;
+        while(!(item = take())) {
+            if(!itemAvailable_.timed_wait(lock, deadline)) {
+                return take();
+            }
+        }
+        return item;
+    }
+
+    //Number of items that were replaced before anyone took them
+    unsigned long dropped() const {
+        return dropped_.load();
+    }
+
+private:
+    atomic_value<T*> slot_;
+    atomic_value<unsigned long> dropped_;
+    boost::mutex waitMutex_;
+    boost::condition_variable itemAvailable_;
+};
+
+#endif
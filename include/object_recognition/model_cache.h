@@ -0,0 +1,68 @@
+#ifndef OBJECT_RECOGNITION_MODEL_CACHE_H
+#define OBJECT_RECOGNITION_MODEL_CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <opencv2/core/core.hpp>
+
+//64 bit FNV-1a over everything added, used to tell whether a cached model
+//still belongs to the training images and parameters
+class content_hash {
+public:
+    content_hash() : value_(14695981039346656037ULL) {}
+
+    void add(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; ++i) {
+            value_ = (value_ ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+    void add(const std::string& s) { add(s.data(), s.size()); add("", 1); }
+    template <typename T> void addValue(const T& value) { add(&value, sizeof(value)); }
+    //Adds the contents of a file, false if it can not be read
+    bool addFile(const std::string& path);
+
+    boost::uint64_t value() const { return value_; }
+
+private:
+    boost::uint64_t value_;
+};
+
+//Everything object_classifier::train() produces. All matrices are CV_32FC1:
+//mean is 1 x inputs, eigenvectors components x inputs, features samples x components.
+//prototypes has one row of color_cascade features per label.
+struct trained_model {
+    cv::Mat mean, eigenvalues, eigenvectors, features, prototypes;
+    std::vector<int> labels;
+    std::map<int, std::string> names;
+};
+
+//Versioned binary file with a trained_model. It is memory mapped when loaded,
+//so the matrices point into the file and nothing is parsed or copied; they
+//stay valid as long as the model_file is open.
+class model_file : boost::noncopyable {
+public:
+    //Bumped whenever the layout or the meaning of the contents change
+    static const boost::uint32_t version = 2;
+
+    model_file() : data_(NULL), size_(0) {}
+    ~model_file() { close(); }
+
+    //False if path does not exist, is not a model of this version or was
+    //written for another hash
+    bool open(const std::string& path, boost::uint64_t hash, trained_model& model);
+    void close();
+
+    //Written to a temporary file first and renamed, so a reader never sees
+    //half a model
+    static bool save(const std::string& path, boost::uint64_t hash, const trained_model& model);
+
+private:
+    void* data_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef OBJECT_RECOGNITION_NEIGHBOR_INDEX_H
+#define OBJECT_RECOGNITION_NEIGHBOR_INDEX_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <object_recognition/distance_kernels.h>
+
+struct neighbor_index_params {
+    neighbor_index_params() :
+        type("bruteforce"),
+        hnswM(16), hnswEfConstruction(100), hnswEfSearch(64),
+        quantized(false)
+    {
+    }
+
+    //"bruteforce" and "vptree" are exact, "hnsw" is approximate
+    std::string type;
+    //Links per node and the candidate list sizes while building and searching
+    int hnswM, hnswEfConstruction, hnswEfSearch;
+    //Store the samples as int8 with a scale per dimension, a quarter of the memory
+    //and the memory traffic per query at a small loss of precision
+    bool quantized;
+};
+
+//Scratch of the searches of one thread, kept so a search allocates nothing.
+//A graph search marks the samples it saw with visited[i] == tag, the next
+//search bumps the tag instead of clearing the buffer.
+struct neighbor_search_context {
+    neighbor_search_context() : tag(0) {}
+
+    std::vector<unsigned> visited;
+    unsigned tag;
+};
+
+//Nearest neighbor search over the PCA projected training samples.
+//Distances are squared L2, like cv::KNearest reports them.
+class neighbor_index {
+public:
+    explicit neighbor_index(bool quantized = false) : quantized_(quantized), size_(0), dims_(0) {}
+    virtual ~neighbor_index() {}
+
+    //features has one CV_32FC1 row per sample, the index keeps its own copy
+    virtual void build(const cv::Mat& features) = 0;
+
+    //The min(k, size()) nearest samples, nearest first. Threads searching at the
+    //same time need a context each.
+    virtual void search(const float* query, int k, std::vector<int>& indices, std::vector<float>& distances,
+                        neighbor_search_context& context) const = 0;
+    //search() for every CV_32FC1 row of queries, indices[i] belongs to row i.
+    //Indexes that can share work between the queries override it.
+    virtual void searchBatch(const cv::Mat& queries, int k, std::vector<std::vector<int> >& indices,
+                             std::vector<std::vector<float> >& distances, neighbor_search_context& context) const;
+
+    int size() const { return size_; }
+    int dims() const { return dims_; }
+    bool quantized() const { return quantized_; }
+    //Empty for a quantized index once it is built
+    const cv::Mat& features() const { return features_; }
+
+    //NULL for an unknown type, the caller owns the index
+    static neighbor_index* create(const neighbor_index_params& params);
+
+protected:
+    //Called by build() before and after the index structure is built.
+    //The float rows are there in between, for a quantized index already
+    //dequantized. Afterwards a quantized index only keeps the int8 codes.
+    void setFeatures(const cv::Mat& features);
+    void finishBuild();
+
+    //Only while building for a quantized index
+    const float* sample(int i) const { return features_.ptr<float>(i); }
+
+    float distance(const float* query, int i) const {
+        return features_.empty() ?
+            squaredDistanceQuantized(query, codes_.ptr<signed char>(i), &scale_[0], dims_) :
+            squaredDistance(query, sample(i), dims_);
+    }
+
+private:
+    bool quantized_;
+    int size_, dims_;
+    cv::Mat features_;
+    //CV_8SC1, sample i dimension j is codes_(i, j) * scale_[j]
+    cv::Mat codes_;
+    std::vector<float> scale_;
+};
+
+//Majority vote over the labels of the k nearest neighbors, the way cv::KNearest
+//does it: the neighbor labels are sorted and the first of the most frequent ones
+//wins, so a tie goes to the smallest label. votes is the size of the majority.
+int voteNeighbors(const std::vector<int>& neighborLabels, int& votes);
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef OBJECT_RECOGNITION_OBJECT_CLASSIFIER_H
+#define OBJECT_RECOGNITION_OBJECT_CLASSIFIER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <opencv2/core/core.hpp>
+#include <object_recognition/neighbor_index.h>
+#include <object_recognition/color_cascade.h>
+#include <object_recognition/pca_trainer.h>
+#include <object_recognition/model_cache.h>
+#include <object_recognition/sample_pack.h>
+
+//Everything that tunes the classification, the defaults are the ones of the node
+struct classifier_params {
+    classifier_params() :
+        neighborCount(7),
+        sampleWidth(100), sampleHeight(100),
+        attributes(1),
+        pcaAccuracy(0.99f),
+        pcaTrainer("full"),
+        blurSize(9),
+        loadPca(true), savePca(false),
+        loaderThreads(0),
+        fusedPreprocess(false)
+    {
+    }
+
+    int neighborCount;
+    //Crops are scaled to this size before they are turned into a feature row
+    int sampleWidth, sampleHeight;
+    //Channels per pixel in the feature row, starting with the hue
+    int attributes;
+    //Retained variance of the PCA
+    float pcaAccuracy;
+    //"full" decomposes the whole covariance with cv::PCA, "truncated" computes
+    //only the retained components with a pca_trainer. Stays full until
+    //recognition_benchmark shows the truncated one is faster at the same accuracy.
+    std::string pcaTrainer;
+    pca_trainer_params pcaTraining;
+    int blurSize;
+    //The PCA is loaded from / saved to pcaFile instead of being computed
+    std::string pcaFile;
+    bool loadPca, savePca;
+    //Binary cache of the trained model, see model_file. Used instead of training
+    //while the training images and the parameters above are unchanged.
+    std::string modelFile;
+    //Threads decoding the training images, 0 for one per core
+    int loaderThreads;
+    //classify() uses preprocessFused() instead of preprocess(). Off until replay_benchmark
+    //--compare shows it agrees with the preprocessing of the training samples.
+    bool fusedPreprocess;
+    //Search structure over the projected training samples
+    neighbor_index_params index;
+    //Color histogram stage in front of the PCA and the KNN search
+    cascade_params cascade;
+};
+
+struct classification_result {
+    classification_result() : label(-1), votes(0), cascade(false), cascadeConfidence(0), colorConsistent(true) {}
+
+    int label;
+    std::string name;
+    //Neighbors that voted for label
+    int votes;
+    //Labels and squared distances of the neighbors, nearest first. Empty when
+    //the cascade answered.
+    std::vector<int> neighborLabels;
+    std::vector<float> neighborDistances;
+    //Answered by the color cascade, without the PCA and the KNN search. There are
+    //no neighbors then, cascadeConfidence is the margin of its prototype match.
+    bool cascade;
+    float cascadeConfidence;
+    //name contains the color the crop was classified with, always true without one
+    bool colorConsistent;
+};
+
+//Time spent in each stage of the last classify(), in milliseconds.
+//All zero while the timing of the classifier is turned off.
+struct classification_timings {
+    classification_timings() { clear(); }
+    void clear() { preprocess = cascade = projection = knn = total = 0; }
+
+    double preprocess;
+    double cascade;
+    double projection;
+    double knn;
+    double total;
+};
+
+//Buffers and timings of the classifications of one thread. The const methods
+//of object_classifier that take a context can run on several threads at once,
+//each with its own context, once the classifier is trained.
+struct classification_context {
+    classification_context() : timing(true) {}
+
+    classification_timings timings;
+    bool timing;
+    //Blurred HSV image of the last classify(), at the crop size or, with
+    //fusedPreprocess, at the sample size
+    cv::Mat blurredImage;
+    //Scratch, kept so the buffers are reused
+    cv::Mat sample, row, projected, small, smallHsv, centered;
+    std::vector<int> neighbors;
+    neighbor_search_context search;
+    std::vector<float> cascadeFeature;
+    std::vector<char> allowedLabels;
+};
+
+//The PCA + KNN classification of object_recognition without anything ROS.
+//Training images are HSV crops in one directory per object, like sample_images/.
+//The neighbors are found by a neighbor_index and voted on like cv::KNearest does.
+//A color_cascade answers the crops it is sure about before that.
+//Samples can be added while classifying, see addSample().
+class object_classifier {
+public:
+    typedef std::vector<std::pair<std::string, std::vector<std::string> > > image_paths;
+
+    explicit object_classifier(const classifier_params& params = classifier_params());
+
+    //Takes effect with the next train()
+    void configure(const classifier_params& params) { params_ = params; }
+    const classifier_params& params() const { return params_; }
+
+    //Trains on all images below imagedir, which has to end with a '/', or on
+    //the sample pack imagedir names. Maps params().modelFile instead if it was
+    //trained on the same images. Images of another size than the sample size
+    //are scaled to it.
+    //Returns false if no image was found.
+    bool train(const std::string& imagedir);
+
+    //Blurred HSV crop scaled to the sample size and its feature row. This is how
+    //the training samples were made: blurred at the crop size, then scaled.
+    void preprocess(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row) { preprocess(bgrImage, hsvSample, row, context_); }
+    void preprocess(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row, classification_context& context) const;
+    //Close to preprocess(), but scales the crop first and blurs it with a kernel
+    //scaled along, so the conversion and the blur only see the sample size.
+    //Allocates nothing once hsvSample and row have their size.
+    void preprocessFused(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row) { preprocessFused(bgrImage, hsvSample, row, context_); }
+    void preprocessFused(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row, classification_context& context) const;
+    //Projects a feature row onto the PCA basis, allocates nothing once projected has its size
+    void project(const cv::Mat& row, cv::Mat& projected) { project(row, projected, context_); }
+    void project(const cv::Mat& row, cv::Mat& projected, classification_context& context) const;
+
+    //Classifies a bgr8 crop
+    void classify(const cv::Mat& bgrImage, classification_result& result) { classify(bgrImage, std::string(), result, context_); }
+    void classify(const cv::Mat& bgrImage, classification_result& result, classification_context& context) const {
+        classify(bgrImage, std::string(), result, context);
+    }
+    //The same for a crop the detection found with color, like "red". The cascade
+    //only answers with classes whose name contains color, the KNN answer is
+    //marked in result.colorConsistent.
+    void classify(const cv::Mat& bgrImage, const std::string& color, classification_result& result,
+                  classification_context& context) const;
+    //Classifies a feature row of preprocess()
+    void classifyRow(const cv::Mat& row, classification_result& result) { classifyRow(row, result, context_); }
+    void classifyRow(const cv::Mat& row, classification_result& result, classification_context& context) const;
+
+    //Classifies bgr8 crops together, like the detections of one frame or a
+    //replayed data set: one matrix product projects all of them and the index
+    //is searched for the whole batch. results[i] belongs to bgrImages[i], the
+    //timings are those of the whole batch. The cascade is not used.
+    void classifyBatch(const std::vector<cv::Mat>& bgrImages, std::vector<classification_result>& results);
+    //The same for feature rows, one per row of rows
+    void classifyRows(const cv::Mat& rows, std::vector<classification_result>& results);
+
+    //Classifies every training sample by the others: the sample itself is left
+    //out of its neighbors, but not out of the PCA. expected gets the labels of
+    //the samples. Samples added with addSample() are searched, not classified.
+    void leaveOneOut(std::vector<int>& expected, std::vector<classification_result>& results) const;
+
+    //Online learning: projects a bgr8 crop onto the current basis and adds it to
+    //the samples that are searched, a new name becomes a new label. Classification
+    //goes on, it only waits for the projection of the sample. False before train().
+    bool addSample(const cv::Mat& bgrImage, const std::string& name, classification_context& context);
+    //Samples added since train() or the last updateModel()
+    int addedSamples() const;
+    //Updates the PCA with the added samples, re-projects all samples onto the new
+    //basis and rebuilds the index. Runs without blocking classification, which
+    //only waits for the swap at the end, so it is meant for a background thread.
+    //The model file is not updated. False if there was nothing to update.
+    bool updateModel();
+
+    //Search structure over the projected training samples, NULL before train().
+    //Replaced by updateModel().
+    const neighbor_index* index() const { return index_.get(); }
+
+    //Of the classifier's own context, which the methods without one use
+    const cv::Mat& blurredImage() const { return context_.blurredImage; }
+    const classification_timings& timings() const { return context_.timings; }
+    void setTiming(bool enabled) { context_.timing = enabled; }
+
+    //A copy, addSample() can add labels meanwhile
+    std::map<int, std::string> labels() const;
+    bool trained() const { return trained_; }
+
+    //One entry per object directory with the file names of its images
+    static image_paths readTestImagePaths(const std::string& directory);
+
+    //Row of the first attributes channels of every pixel as floats
+    cv::Mat matToFloatRow(const cv::Mat& input) const;
+    //The same written to row, which has room for input.total() * attributes floats
+    void matToFloatRow(const cv::Mat& input, float* row) const;
+    //The same as bytes, the training samples are kept like this until the PCA is trained
+    void matToByteRow(const cv::Mat& input, uchar* row) const;
+    //Scales a training image of another size to the sample size
+    void toSampleSize(cv::Mat& image) const;
+
+private:
+    //samples has one CV_8UC1 row per sample from matToByteRow()
+    void trainPCA(const cv::Mat& samples, cv::Mat& result);
+    //Decodes the images in parallel into one row each of samples. Images that can
+    //not be read are dropped together with their label. False if none could be read.
+    //cascadeData gets the color_cascade features of every image.
+    bool loadImages(const std::vector<std::string>& paths, std::vector<int>& labels, cv::Mat& samples,
+                    cv::Mat& cascadeData) const;
+    bool loadPack(const sample_pack& pack, std::vector<int>& labels, cv::Mat& samples, cv::Mat& cascadeData) const;
+    //Builds the index over the model and takes it over
+    bool useModel(const trained_model& model);
+    //project() and the search of the added samples, with modelMutex_ held
+    void projectRow(const cv::Mat& row, cv::Mat& projected, classification_context& context) const;
+    //Merges the added samples into the nearest k the index found
+    void searchAdded(const float* query, int k, std::vector<int>& indices, std::vector<float>& distances) const;
+    //Hash of the images below imagedir and of everything else the model depends on
+    boost::uint64_t modelHash(const std::string& imagedir, const image_paths& objects) const;
+    //Answers from the prototypes of the cascade if it is sure, false otherwise
+    bool classifyCascade(const cv::Mat& hsvSample, const std::string& color, classification_result& result,
+                         classification_context& context) const;
+    //Labels, vote and name of result from the indices of its neighbors
+    void vote(const std::vector<int>& neighbors, classification_result& result) const;
+
+    classifier_params params_;
+    classification_context context_;
+    cv::PCA pca_;
+    //pca_ points into the mapped file when the model was loaded from the cache
+    boost::scoped_ptr<model_file> modelFile_;
+    boost::scoped_ptr<neighbor_index> index_;
+    //Projected samples of the index, re-projected by updateModel()
+    cv::Mat features_;
+    //Samples added since the index was built, searched by brute force next to it.
+    //Raw feature rows for the PCA update and their projections. Their labels
+    //follow those of the index in sampleLabels_.
+    cv::Mat addedRows_, addedFeatures_;
+    std::vector<int> sampleLabels_;
+    std::map<int, std::string> intToDesc_;
+    color_cascade cascade_;
+    //The model above is read under a shared lock and changed under a unique one
+    mutable boost::shared_mutex modelMutex_;
+    //One updateModel() at a time
+    boost::mutex updateMutex_;
+    bool trained_;
+    //Scratch of the batches
+    cv::Mat batchRows_, batchCentered_, batchProjected_;
+    std::vector<std::vector<int> > batchNeighbors_;
+    std::vector<std::vector<float> > batchDistances_;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef OBJECT_RECOGNITION_OBJECT_DETECTOR_H
+#define OBJECT_RECOGNITION_OBJECT_DETECTOR_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <object_recognition/cloud_view.h>
+#include <object_recognition/contour_extraction.h>
+#include <object_recognition/hsv_labeling.h>
+#include <object_recognition/depth_crop.h>
+#include <object_recognition/roi_tracker.h>
+
+//Color range of one object color in OpenCV's HSV space (h 0-180).
+//hmin ... vmax are references into min and max, so the trackbars and the
+//parameter loading can set single channels.
+class hsv_range {
+public:
+    hsv_range() :
+        inverted(false), includeInvalid(true),
+        hmin(min[0]), smin(min[1]), vmin(min[2]),
+        hmax(max[0]), smax(max[1]), vmax(max[2]),
+        updiffh(0), updiffs(0), updiffv(0),
+        lowdiffh(0), lowdiffs(0), lowdiffv(0)
+    {
+    }
+
+    hsv_range(const hsv_range& other) :
+        hmin(min[0]), smin(min[1]), vmin(min[2]),
+        hmax(max[0]), smax(max[1]), vmax(max[2])
+    {
+        *this = other;
+    }
+
+    hsv_range& operator=(const hsv_range& other) {
+        color = other.color;
+        min = other.min;
+        max = other.max;
+        inverted = other.inverted;
+        includeInvalid = other.includeInvalid;
+        updiffh = other.updiffh; updiffs = other.updiffs; updiffv = other.updiffv;
+        lowdiffh = other.lowdiffh; lowdiffs = other.lowdiffs; lowdiffv = other.lowdiffv;
+        return *this;
+    }
+
+    template <typename T> void setValues(const T& hmin, const T& smin, const T& vmin,
+                                         const T& hmax, const T& smax, const T& vmax) {
+        this->hmin = hmin;
+        this->smin = smin;
+        this->vmin = vmin;
+        this->hmax = hmax;
+        this->smax = smax;
+        this->vmax = vmax;
+    }
+
+    std::string color;
+
+    cv::Scalar min;
+    cv::Scalar max;
+
+    bool inverted;
+    bool includeInvalid;
+    double& hmin;
+    double& smin;
+    double& vmin;
+    double& hmax;
+    double& smax;
+    double& vmax;
+    double updiffh, updiffs, updiffv;
+    double lowdiffh, lowdiffs, lowdiffv;
+};
+
+//Everything that tunes the detection, the defaults are the ones of the node
+struct detector_params {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    detector_params() :
+        areaMin(1000), areaMax(6000),
+        rectPadding(5), heightCorrection(10),
+        cropMin(-10, -10, -10, 0), cropMax(10, 10, 10, 0),
+        roi(0, 150, 0, 0),
+        minPoints(50),
+        blurSize(9),
+        tracking(false), trackingPadding(40), trackingRefresh(10),
+        pyramidScale(1)
+    {
+    }
+
+    std::vector<hsv_range> ranges;
+    //Contours are kept if areaMin < area < areaMax, in pixels
+    double areaMin, areaMax;
+    //Added around the bounding rect of an object for its crop, heightCorrection only at the bottom
+    int rectPadding, heightCorrection;
+    //Crop box in the robot frame
+    Eigen::Vector4f cropMin, cropMax;
+    //Only this part of the image is searched, width or height <= 0 extend to the border
+    cv::Rect roi;
+    //Objects with less finite depth points are dropped
+    int minPoints;
+    //Median blur kernel at full resolution
+    int blurSize;
+    //After a detection only search around it, with a full search every trackingRefresh frames
+    bool tracking;
+    int trackingPadding, trackingRefresh;
+    //Full frame searches find candidates on an image this many times smaller first, 1 turns it off
+    int pyramidScale;
+};
+
+//One camera frame. The cloud is organized, has the size of the image and
+//cameraToRobot moves its points into the robot frame.
+struct detection_input {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    detection_input() :
+        cameraToRobot(Eigen::Affine3f::Identity())
+    {
+    }
+
+    organized_cloud_view cloud;
+    cv::Mat image;
+    Eigen::Affine3f cameraToRobot;
+};
+
+struct detected_object {
+    int colorIndex;
+    std::string color;
+    double area;
+    std::vector<cv::Point> contour;
+    //Bounding rect of the contour and the padded rect the crop is taken from
+    cv::Rect rect, cropRect;
+    //Centroid of the finite points inside the contour, in the robot frame
+    Eigen::Vector3f centroid;
+    size_t validPoints;
+};
+
+//Time spent in each stage of the last detect(), in milliseconds.
+//All zero while the timing of the detector is turned off.
+struct detection_timings {
+    detection_timings() { clear(); }
+    void clear() { depth = blur = labeling = contours = extraction = total = 0; }
+
+    double depth;
+    double blur;
+    double labeling;
+    double contours;
+    double extraction;
+    double total;
+};
+
+//The segmentation and extraction of object_detection without anything ROS.
+//A frame is cropped by depth, blurred, labeled against all color ranges and the
+//contours of every color that pass the area filters are moved into 3D.
+class object_detector {
+public:
+    object_detector();
+
+    //Returns false if some of the ranges do not fit into the label table
+    bool configure(const detector_params& params);
+    const detector_params& params() const { return params_; }
+
+    //The ranges can be changed in place, e.g. by trackbars, rangesChanged() applies them
+    std::vector<hsv_range>& ranges() { return params_.ranges; }
+    void rangesChanged();
+
+    //Finds the objects of a frame, largest first. With all == false only the
+    //largest contour is extracted, nothing is returned if it has too few points.
+    void detect(const detection_input& frame, std::vector<detected_object>& objects, bool all = true);
+
+    const detection_timings& timings() const { return timings_; }
+    void setTiming(bool enabled) { timing_ = enabled; }
+
+    //Blurred HSV image, label table and position of the region segmented last
+    const cv::Mat& hsvImage() const { return blurredImage_; }
+    const hsv_label_table& labels() const { return labeler_; }
+    const cv::Rect& segmentedRegion() const { return segmentedRegion_; }
+    void resetTracking() { tracker_.reset(); }
+
+private:
+    //Contour that passed the area filters
+    struct object_candidate {
+        object_candidate(int colorIndex, double area, const std::vector<cv::Point>& contour) :
+            colorIndex(colorIndex), area(area), contour(contour)
+        {
+        }
+
+        //Largest first
+        bool operator<(const object_candidate& other) const {
+            return area > other.area;
+        }
+
+        int colorIndex;
+        double area;
+        std::vector<cv::Point> contour;
+    };
+
+    //Segments region and extracts the largest candidate or all of them, returns the bounding rect of what was found
+    cv::Rect search(const detection_input& frame, const cv::Rect& region, std::vector<detected_object>& objects, bool all);
+    void segment(const detection_input& frame, const cv::Rect& region, std::vector<object_candidate>& candidates);
+    void segmentPyramid(const detection_input& frame, const cv::Rect& region, std::vector<object_candidate>& candidates);
+    bool extract(const detection_input& frame, const object_candidate& candidate, detected_object& object);
+    cv::Rect paddedRect(cv::Rect objRect, int rows, int cols) const;
+
+    detector_params params_;
+    detection_timings timings_;
+    bool timing_;
+    contour_extractor extractor_;
+    hsv_label_table labeler_;
+    depth_crop_filter depthFilter_;
+    roi_tracker tracker_;
+    cv::Mat depthMaskIncluded_, depthMaskExcluded_;
+    cv::Mat blurredImage_, contourMask_, coarseImage_;
+    cv::Rect segmentedRegion_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef OBJECT_RECOGNITION_PCA_TRAINER_H
+#define OBJECT_RECOGNITION_PCA_TRAINER_H
+
+#include <opencv2/core/core.hpp>
+
+struct pca_trainer_params {
+    pca_trainer_params() :
+        blockSize(256),
+        initialComponents(64),
+        oversampling(16),
+        powerIterations(2),
+        seed(0x5eed)
+    {
+    }
+
+    //Rows or columns of the samples that are converted to floats at a time
+    int blockSize;
+    //Components tried first, doubled until they hold the retained variance
+    int initialComponents;
+    //Extra directions of the randomized subspace, they make the last components accurate
+    int oversampling;
+    int powerIterations;
+    //Runs on the same samples give the same basis
+    unsigned int seed;
+};
+
+//PCA that only computes the leading components, as many as the retained
+//variance needs. The samples are read a block at a time and are centered and
+//converted to floats block by block, so they can stay 8 bit.
+//
+//The leading eigenvectors of the samples x samples Gram matrix, with fewer
+//samples than inputs, or of the inputs x inputs covariance are found by a
+//randomized subspace iteration (Halko, Martinsson and Tropp, "Finding
+//structure with randomness") and Rayleigh-Ritz on the subspace, instead of
+//decomposing the whole matrix like cv::PCA does. Neither matrix is formed,
+//every product with it goes through the samples block by block.
+class pca_trainer {
+public:
+    explicit pca_trainer(const pca_trainer_params& params = pca_trainer_params()) : params_(params) {}
+
+    //samples has one CV_8UC1 or CV_32FC1 row per sample. pca gets the mean,
+    //eigenvalues and eigenvectors like cv::PCA with retainedVariance, features
+    //the projections of the samples. False without samples.
+    bool train(const cv::Mat& samples, float retainedVariance, cv::PCA& pca, cv::Mat& features) const;
+
+private:
+    pca_trainer_params params_;
+};
+
+#endif
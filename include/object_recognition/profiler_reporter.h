@@ -0,0 +1,93 @@
+#ifndef OBJECT_RECOGNITION_PROFILER_REPORTER_H
+#define OBJECT_RECOGNITION_PROFILER_REPORTER_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <object_recognition/stage_profiler.h>
+
+//Publishes the stage_profiler of a node every <name>/profiling/period seconds
+//on /diagnostics and, with <name>/profiling/log, as a log line.
+//<name>/profiling/enabled is read again before every report, so the
+//instrumentation can be switched off and on while the node runs.
+class profiler_reporter {
+public:
+    profiler_reporter(ros::NodeHandle& nh, stage_profiler& profiler, const std::string& name) :
+        nh_(nh),
+        profiler_(profiler),
+        name_(name),
+        log_(false)
+    {
+    }
+
+    void start() {
+        double period;
+        nh_.param(name_ + "/profiling/period", period, 5.0);
+        nh_.param(name_ + "/profiling/log", log_, false);
+        readEnabled();
+        diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+        if(period > 0) {
+            timer_ = nh_.createTimer(ros::Duration(period), &profiler_reporter::report, this);
+        }
+    }
+
+private:
+    void readEnabled() {
+        bool enabled;
+        nh_.param(name_ + "/profiling/enabled", enabled, true);
+        profiler_.setEnabled(enabled);
+    }
+
+    void report(const ros::TimerEvent&) {
+        const bool wasEnabled = profiler_.enabled();
+        readEnabled();
+        if(!wasEnabled) {
+            return;
+        }
+        profiler_.collect(stages_, counters_);
+
+        diagnostic_msgs::DiagnosticArray msg;
+        msg.header.stamp = ros::Time::now();
+        msg.status.resize(1);
+        diagnostic_msgs::DiagnosticStatus& status = msg.status[0];
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = name_ + ": profiling";
+        status.message = "latencies in ms since the last report";
+        for(size_t i = 0; i < stages_.size(); ++i) {
+            const latency_histogram::summary& s = stages_[i].latency;
+            addValue(status, stages_[i].name + " count", s.count);
+            addValue(status, stages_[i].name + " p50", s.p50);
+            addValue(status, stages_[i].name + " p99", s.p99);
+            addValue(status, stages_[i].name + " max", s.max);
+        }
+        for(size_t i = 0; i < counters_.size(); ++i) {
+            addValue(status, counters_[i].first, counters_[i].second);
+        }
+        diagnostics_pub_.publish(msg);
+
+        if(log_) {
+            ROS_INFO("%s: %s", name_.c_str(), stage_profiler::format(stages_, counters_).c_str());
+        }
+    }
+
+    template <typename T> static void addValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const T& value) {
+        diagnostic_msgs::KeyValue kv;
+        kv.key = key;
+        std::ostringstream ss; ss << value;
+        kv.value = ss.str();
+        status.values.push_back(kv);
+    }
+
+    ros::NodeHandle& nh_;
+    stage_profiler& profiler_;
+    std::string name_;
+    bool log_;
+    ros::Publisher diagnostics_pub_;
+    ros::Timer timer_;
+    std::vector<stage_profiler::stage_summary> stages_;
+    std::vector<std::pair<std::string, unsigned long> > counters_;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef OBJECT_RECOGNITION_RESULT_CACHE_H
+#define OBJECT_RECOGNITION_RESULT_CACHE_H
+
+#include <list>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <opencv2/core/core.hpp>
+#include <object_recognition/object_classifier.h>
+
+struct result_cache_params {
+    result_cache_params() :
+        enabled(false),
+        capacity(32),
+        ttl(1.0),
+        maxHashDistance(6),
+        positionBucket(0.05f)
+    {
+    }
+
+    //Hits are no evidence for the decision engine and the ttl runs from the
+    //insert, so a still object gets one new classification per ttl. Off until
+    //that is shown not to delay decisions.
+    bool enabled;
+    //Results kept, the least recently used one goes first
+    int capacity;
+    //Seconds a result is reused for
+    double ttl;
+    //Bits the hashes of two crops may differ in to be the same
+    int maxHashDistance;
+    //Edge of the cubes in meters the positions are put into
+    float positionBucket;
+};
+
+//What identifies a crop: the detection's color, the cube of its position and
+//a perceptual hash of the crop itself
+struct result_key {
+    result_key() : hash(0) { bucket[0] = bucket[1] = bucket[2] = 0; }
+
+    std::string color;
+    int bucket[3];
+    boost::uint64_t hash;
+};
+
+//Difference hash of a crop: scaled to 9 x 8 gray pixels, one bit per pair of
+//horizontal neighbors. Small shifts, scaling and noise change only a few bits.
+boost::uint64_t perceptualHash(const cv::Mat& bgrImage);
+
+//Small LRU cache of classification results. The same object is sent in many
+//consecutive frames, a crop near enough to a recent one at the same place gets
+//its result without being classified again. Can be used by several threads.
+class result_cache : boost::noncopyable {
+public:
+    explicit result_cache(const result_cache_params& params = result_cache_params()) :
+        params_(params), hits_(0), misses_(0)
+    {
+    }
+
+    void configure(const result_cache_params& params);
+    const result_cache_params& params() const { return params_; }
+
+    //Key of a crop found at point
+    result_key key(const cv::Mat& bgrImage, const std::string& color, const float* point) const;
+
+    //The result of an entry matching key that is not older than the ttl at now,
+    //in seconds. Counts a hit or a miss.
+    bool lookup(const result_key& key, double now, classification_result& result);
+    void insert(const result_key& key, double now, const classification_result& result);
+    //After the model changed
+    void clear();
+
+    unsigned long hits() const;
+    unsigned long misses() const;
+
+private:
+    struct entry {
+        result_key key;
+        double time;
+        classification_result result;
+    };
+
+    bool matches(const result_key& a, const result_key& b) const;
+
+    result_cache_params params_;
+    //Most recently used first
+    std::list<entry> entries_;
+    unsigned long hits_, misses_;
+    mutable boost::mutex mutex_;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef OBJECT_RECOGNITION_ROI_TRACKER_H
+#define OBJECT_RECOGNITION_ROI_TRACKER_H
+
+#include <opencv2/core/core.hpp>
+
+//Remembers where the objects of the last frame were, so the next frame only has
+//to be segmented around them. The whole image is searched again every
+//refreshInterval frames, so new objects are still found, and by object_detector
+//in the same frame when nothing is found around the track.
+class roi_tracker {
+public:
+    roi_tracker() :
+        enabled_(false),
+        padding_(40),
+        refreshInterval_(10),
+        tracking_(false),
+        framesSinceRefresh_(0)
+    {
+    }
+
+    //padding in pixels around the last rect, refreshInterval in frames
+    void configure(bool enabled, int padding, int refreshInterval) {
+        enabled_ = enabled;
+        padding_ = padding;
+        refreshInterval_ = refreshInterval;
+        reset();
+    }
+
+    void reset() {
+        tracking_ = false;
+        framesSinceRefresh_ = 0;
+    }
+
+    //Region to segment in the next frame
+    cv::Rect searchRegion(const cv::Size& imageSize) {
+        const cv::Rect image(0, 0, imageSize.width, imageSize.height);
+        if(!enabled_ || !tracking_ || framesSinceRefresh_ >= refreshInterval_) {
+            framesSinceRefresh_ = 0;
+            return image;
+        }
+        ++framesSinceRefresh_;
+        cv::Rect region(last_.x - padding_, last_.y - padding_, last_.width + 2*padding_, last_.height + 2*padding_);
+        region &= image;
+        return region.area() > 0 ? region : image;
+    }
+
+    //Bounding rect of what was found in the region, an empty rect when nothing was found
+    void update(const cv::Rect& found) {
+        tracking_ = enabled_ && found.area() > 0;
+        if(tracking_) {
+            last_ = found;
+        }
+    }
+
+    bool tracking() const { return tracking_; }
+
+private:
+    bool enabled_;
+    int padding_;
+    int refreshInterval_;
+    bool tracking_;
+    int framesSinceRefresh_;
+    cv::Rect last_;
+};
+
+#endif
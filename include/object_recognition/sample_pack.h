@@ -0,0 +1,89 @@
+#ifndef OBJECT_RECOGNITION_SAMPLE_PACK_H
+#define OBJECT_RECOGNITION_SAMPLE_PACK_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <opencv2/core/core.hpp>
+
+//A training set like sample_images/ in one file:
+//  header | label table of labelCapacity names | records
+//Every record is the label index and the 8 bit, 3 channel pixels of one sample,
+//all records have the same size, so sample i is at a fixed offset. Records are
+//only ever appended and the header is written last, so a pack stays readable
+//if appending is interrupted.
+namespace sample_pack_format {
+    const boost::uint32_t version = 1;
+    const int labelCapacity = 256;
+    //Including the terminating zero
+    const int labelLength = 64;
+}
+
+//Read-only, memory mapped view of a pack
+class sample_pack : boost::noncopyable {
+public:
+    sample_pack();
+    ~sample_pack() { close(); }
+
+    //False if path is not a pack of this version
+    bool open(const std::string& path);
+    void close();
+
+    int size() const { return size_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const std::vector<std::string>& labelNames() const { return labelNames_; }
+
+    int label(int i) const { return *reinterpret_cast<const boost::int32_t*>(record(i)); }
+    //CV_8UC3 header pointing into the mapping, valid while the pack is open.
+    //Stored in HSV, like the images in sample_images/.
+    cv::Mat image(int i) const {
+        return cv::Mat(height_, width_, CV_8UC3, const_cast<char*>(record(i) + recordHeader));
+    }
+
+private:
+    static const int recordHeader = 8;
+
+    const char* record(int i) const { return records_ + size_t(i) * stride_; }
+
+    void* data_;
+    size_t mapped_;
+    const char* records_;
+    int size_, width_, height_;
+    size_t stride_;
+    std::vector<std::string> labelNames_;
+};
+
+//Creates a pack or appends to an existing one
+class sample_pack_writer : boost::noncopyable {
+public:
+    sample_pack_writer();
+    ~sample_pack_writer() { close(); }
+
+    //Opens path for appending, or creates it for width x height samples if it
+    //does not exist. False if it exists with another sample size, 0 takes the
+    //size of the existing pack.
+    bool open(const std::string& path, int width, int height);
+    //image has to be CV_8UC3 of the pack size. False if it is not or if all
+    //labelCapacity labels are taken.
+    bool add(const std::string& labelName, const cv::Mat& image);
+    //Writes the header, the samples added so far become visible to readers
+    bool close();
+
+    int size() const { return size_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+private:
+    bool writeHeader();
+
+    FILE* file_;
+    int size_, width_, height_;
+    size_t stride_;
+    std::vector<std::string> labelNames_;
+    std::vector<char> record_;
+};
+
+#endif
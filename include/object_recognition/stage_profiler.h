@@ -0,0 +1,244 @@
+#ifndef OBJECT_RECOGNITION_STAGE_PROFILER_H
+#define OBJECT_RECOGNITION_STAGE_PROFILER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <opencv2/core/core.hpp>
+#include <object_recognition/atomic_value.h>
+
+//Adds the time until it goes out of scope to a millisecond total.
+//A disabled timer does not even read the clock.
+class scoped_timer : boost::noncopyable {
+public:
+    explicit scoped_timer(double& total, bool enabled = true) :
+        total_(enabled ? &total : NULL),
+        start_(enabled ? cv::getTickCount() : 0)
+    {
+    }
+
+    ~scoped_timer() {
+        if(total_) {
+            *total_ += (cv::getTickCount() - start_) * 1000.0 / cv::getTickFrequency();
+        }
+    }
+
+private:
+    double* total_;
+    int64 start_;
+};
+
+//Latency histogram that any number of threads can add to without a lock.
+//Values are microseconds. Below 16 every value has its own bucket, above that
+//every power of two is split into 8 buckets, so a percentile is at most 12.5 %
+//below the real value. Adding a sample is one atomic increment and,
+//for a new maximum, a compare and swap.
+class latency_histogram : boost::noncopyable {
+public:
+    static const int linearBuckets = 16;
+    static const int subBuckets = 8;
+    static const int bucketCount = linearBuckets + (32 - 4) * subBuckets;
+
+    latency_histogram() {
+        reset();
+    }
+
+    void add(double ms) {
+        const unsigned long us = ms > 0 ? static_cast<unsigned long>(ms * 1000.0) : 0;
+        buckets_[bucket(us)].fetch_add(1);
+        unsigned long max = max_.load();
+        while(us > max && !max_.compare_exchange(max, us)) {
+        }
+    }
+
+    struct summary {
+        unsigned long count;
+        double p50, p99, max;
+    };
+
+    //Summary of everything added since the last reset, in milliseconds.
+    //With reset the histogram starts over, samples added meanwhile can end up in either window.
+    summary collect(bool reset) {
+        unsigned long counts[bucketCount];
+        summary s;
+        s.count = 0;
+        for(int i = 0; i < bucketCount; ++i) {
+            counts[i] = reset ? buckets_[i].exchange(0) : buckets_[i].load();
+            s.count += counts[i];
+        }
+        s.max = (reset ? max_.exchange(0) : max_.load()) / 1000.0;
+        s.p50 = percentile(counts, s.count, 0.5);
+        s.p99 = percentile(counts, s.count, 0.99);
+        return s;
+    }
+
+    void reset() {
+        for(int i = 0; i < bucketCount; ++i) {
+            buckets_[i].store(0);
+        }
+        max_.store(0);
+    }
+
+private:
+    static int bucket(unsigned long us) {
+        if(us < static_cast<unsigned long>(linearBuckets)) {
+            return int(us);
+        }
+        int exponent = 4;
+        while(exponent < 31 && (us >> (exponent + 1)) != 0) {
+            ++exponent;
+        }
+        const int sub = int((us >> (exponent - 3)) & (subBuckets - 1));
+        return linearBuckets + (exponent - 4) * subBuckets + sub;
+    }
+
+    //Lower bound of a bucket in microseconds
+    static double bucketValue(int index) {
+        if(index < linearBuckets) {
+            return index;
+        }
+        const int exponent = 4 + (index - linearBuckets) / subBuckets;
+        const int sub = (index - linearBuckets) % subBuckets;
+        return double(1ul << exponent) + sub * double(1ul << (exponent - 3));
+    }
+
+    static double percentile(const unsigned long* counts, unsigned long total, double p) {
+        if(total == 0) {
+            return 0;
+        }
+        const unsigned long rank = std::max(1ul, static_cast<unsigned long>(p * total + 0.5));
+        unsigned long seen = 0;
+        for(int i = 0; i < bucketCount; ++i) {
+            seen += counts[i];
+            if(seen >= rank) {
+                return bucketValue(i) / 1000.0;
+            }
+        }
+        return bucketValue(bucketCount - 1) / 1000.0;
+    }
+
+    atomic_value<unsigned long> buckets_[bucketCount];
+    atomic_value<unsigned long> max_;
+};
+
+//Named latency histograms and event counters of one node.
+//Stages and counters are added once before the worker threads start, after that
+//record() and count() can be called from any thread. When disabled both return
+//right away, so the instrumentation can stay in the hot path.
+class stage_profiler : boost::noncopyable {
+public:
+    static const int maxStages = 16;
+    static const int maxCounters = 16;
+
+    stage_profiler() :
+        enabled_(true),
+        stageCount_(0),
+        counterCount_(0)
+    {
+        for(int i = 0; i < maxCounters; ++i) {
+            counters_[i].store(0);
+        }
+    }
+
+    int addStage(const std::string& name) {
+        CV_Assert(stageCount_ < maxStages);
+        stageNames_[stageCount_] = name;
+        return stageCount_++;
+    }
+
+    int addCounter(const std::string& name) {
+        CV_Assert(counterCount_ < maxCounters);
+        counterNames_[counterCount_] = name;
+        return counterCount_++;
+    }
+
+    void setEnabled(bool enabled) { enabled_.store(enabled); }
+    bool enabled() const { return enabled_.load(); }
+
+    void record(int stage, double ms) {
+        if(enabled()) {
+            stages_[stage].add(ms);
+        }
+    }
+
+    void count(int counter, unsigned long n = 1) {
+        if(enabled()) {
+            counters_[counter].fetch_add(n);
+        }
+    }
+
+    //Records the time until it goes out of scope as one sample of a stage
+    class scope : boost::noncopyable {
+    public:
+        scope(stage_profiler& profiler, int stage) :
+            profiler_(profiler.enabled() ? &profiler : NULL),
+            stage_(stage),
+            start_(profiler_ ? cv::getTickCount() : 0)
+        {
+        }
+
+        ~scope() {
+            if(profiler_) {
+                profiler_->record(stage_, (cv::getTickCount() - start_) * 1000.0 / cv::getTickFrequency());
+            }
+        }
+
+    private:
+        stage_profiler* profiler_;
+        int stage_;
+        int64 start_;
+    };
+
+    struct stage_summary {
+        std::string name;
+        latency_histogram::summary latency;
+    };
+
+    //Stages and counters since the last collect(), which starts a new window
+    void collect(std::vector<stage_summary>& stages, std::vector<std::pair<std::string, unsigned long> >& counters) {
+        stages.resize(stageCount_);
+        for(int i = 0; i < stageCount_; ++i) {
+            stages[i].name = stageNames_[i];
+            stages[i].latency = stages_[i].collect(true);
+        }
+        counters.resize(counterCount_);
+        for(int i = 0; i < counterCount_; ++i) {
+            counters[i] = std::make_pair(counterNames_[i], counters_[i].exchange(0));
+        }
+    }
+
+    //One line for the log, e.g. "blur 1.02/1.54/2.10 ms (150) | dropped 3"
+    static std::string format(const std::vector<stage_summary>& stages,
+                              const std::vector<std::pair<std::string, unsigned long> >& counters) {
+        std::string line;
+        char buffer[128];
+        for(size_t i = 0; i < stages.size(); ++i) {
+            const latency_histogram::summary& s = stages[i].latency;
+            if(s.count == 0) {
+                continue;
+            }
+            snprintf(buffer, sizeof(buffer), "%s%s %.2f/%.2f/%.2f ms (%lu)", line.empty() ? "" : ", ",
+                     stages[i].name.c_str(), s.p50, s.p99, s.max, s.count);
+            line += buffer;
+        }
+        for(size_t i = 0; i < counters.size(); ++i) {
+            snprintf(buffer, sizeof(buffer), "%s%s %lu", i > 0 ? ", " : line.empty() ? "" : " | ", counters[i].first.c_str(), counters[i].second);
+            line += buffer;
+        }
+        return line;
+    }
+
+private:
+    atomic_value<bool> enabled_;
+    int stageCount_;
+    int counterCount_;
+    std::string stageNames_[maxStages];
+    std::string counterNames_[maxCounters];
+    latency_histogram stages_[maxStages];
+    atomic_value<unsigned long> counters_[maxCounters];
+};
+
+#endif
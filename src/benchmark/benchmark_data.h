@@ -0,0 +1,117 @@
+#ifndef OBJECT_RECOGNITION_BENCHMARK_DATA_H
+#define OBJECT_RECOGNITION_BENCHMARK_DATA_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/types.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+#include <object_recognition/sample_pack.h>
+
+//Data sets and latency statistics shared by the benchmarks
+
+//Latencies of one stage in milliseconds
+class stage_samples {
+public:
+    void add(double ms) { samples_.push_back(ms); }
+
+    void print(const char* name) {
+        if(samples_.empty()) {
+            return;
+        }
+        printf("  %-12s %8d %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, int(samples_.size()), mean(),
+               percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+    }
+
+    size_t count() const { return samples_.size(); }
+
+    double mean() const {
+        double sum = 0;
+        for(size_t i = 0; i < samples_.size(); ++i) {
+            sum += samples_[i];
+        }
+        return samples_.empty() ? 0 : sum / samples_.size();
+    }
+
+    //Nearest rank, 0 without samples
+    double percentile(double p) {
+        if(samples_.empty()) {
+            return 0;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        size_t rank = size_t(p * samples_.size() + 0.5);
+        rank = std::min(samples_.size() - 1, rank > 0 ? rank - 1 : 0);
+        return samples_[rank];
+    }
+
+private:
+    std::vector<double> samples_;
+};
+
+//Files of a directory, sorted so runs are comparable
+inline std::vector<std::string> listFiles(const std::string& directory, bool directories) {
+    std::vector<std::string> names;
+    DIR* dirPtr = opendir(directory.c_str());
+    if(dirPtr == NULL) {
+        return names;
+    }
+    for(dirent* entry = readdir(dirPtr); entry != NULL; entry = readdir(dirPtr)) {
+        if(entry->d_name[0] != '.' && (entry->d_type == DT_DIR) == directories) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dirPtr);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+inline std::string withSlash(const std::string& directory) {
+    return (directory.empty() || directory[directory.size() - 1] == '/') ? directory : directory + "/";
+}
+
+//Path and expected label of every image below directory
+inline void listImages(const std::string& directory, std::vector<std::pair<std::string, std::string> >& images) {
+    const std::string dir = withSlash(directory);
+    std::vector<std::string> files = listFiles(dir, false);
+    for(size_t i = 0; i < files.size(); ++i) {
+        images.push_back(std::make_pair(dir + files[i], files[i].substr(0, files[i].find('.'))));
+    }
+    std::vector<std::string> subdirs = listFiles(dir, true);
+    for(size_t i = 0; i < subdirs.size(); ++i) {
+        files = listFiles(dir + subdirs[i], false);
+        for(size_t j = 0; j < files.size(); ++j) {
+            images.push_back(std::make_pair(dir + subdirs[i] + "/" + files[j], subdirs[i]));
+        }
+    }
+}
+
+//Decoding is not part of the node's work, so the images are loaded up front.
+//The crops are stored in HSV, like object_recognition::imgFileCB expects them.
+inline void loadCrops(const std::vector<std::pair<std::string, std::string> >& images, std::vector<cv::Mat>& crops, std::vector<std::string>& expected) {
+    for(size_t i = 0; i < images.size(); ++i) {
+        cv::Mat image = cv::imread(images[i].first);
+        if(image.empty()) {
+            continue;
+        }
+        cv::cvtColor(image, image, CV_HSV2BGR);
+        crops.push_back(image);
+        expected.push_back(images[i].second);
+    }
+}
+
+inline void loadCrops(const sample_pack& pack, std::vector<cv::Mat>& crops, std::vector<std::string>& expected) {
+    for(int i = 0; i < pack.size(); ++i) {
+        cv::Mat image;
+        cv::cvtColor(pack.image(i), image, CV_HSV2BGR);
+        crops.push_back(image);
+        expected.push_back(pack.labelNames()[pack.label(i)]);
+    }
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/filters/filter.h>
+#include <pcl/common/centroid.h>
+
+#include <object_recognition/contour_extraction.h>
+
+//Compares the rasterized contour extraction with the per pixel pointPolygonTest
+//loop object_detection used before. Runs on a synthetic 640x480 organized cloud,
+//no camera or roscore needed.
+//Usage: contour_extraction_benchmark [iterations]
+
+typedef pcl::PointXYZRGB Point;
+typedef pcl::PointCloud<Point> Cloud;
+
+static const int rows = 480;
+static const int cols = 640;
+
+void makeCloud(Cloud& cloud) {
+    cloud.width = cols;
+    cloud.height = rows;
+    cloud.is_dense = false;
+    cloud.points.resize(rows*cols);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for(int y = 0; y < rows; ++y) {
+        for(int x = 0; x < cols; ++x) {
+            Point& p = cloud.at(x, y);
+            //Sprinkle some invalid depth readings like the kinect does
+            if((x*7 + y*13) % 17 == 0) {
+                p.x = p.y = p.z = nan;
+            } else {
+                p.x = (x - cols/2) * 0.002f;
+                p.y = (y - rows/2) * 0.002f;
+                p.z = 0.5f + 0.0005f*x;
+            }
+        }
+    }
+}
+
+//Contour of a filled ellipse, found the same way detect() does it
+std::vector<cv::Point> makeContour(cv::Point center, cv::Size axes) {
+    cv::Mat mask = cv::Mat::zeros(rows, cols, CV_8UC1);
+    cv::ellipse(mask, center, axes, 30, 0, 360, cv::Scalar(255), CV_FILLED);
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> notUsedHierarchy;
+    cv::findContours(mask, contours, notUsedHierarchy, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+    return contours[0];
+}
+
+//The extraction as it was done in object_detection::detect()
+size_t legacyExtract(const std::vector<cv::Point>& contour, const Cloud& cloud, Eigen::Vector4f& massCenter) {
+    Cloud objectCloud;
+    cv::Point2f point;
+    for(int x=0;x<cols; x++){
+        for(int y=0;y<rows; y++){
+            point.x=x;
+            point.y=y;
+            if(0 <= cv::pointPolygonTest(contour,point,false)){
+                objectCloud.points.push_back(cloud.at(x,y));
+            }
+        }
+    }
+    std::vector<int> indicies;
+    Cloud withoutNan;
+    objectCloud.is_dense=false;
+    pcl::removeNaNFromPointCloud(objectCloud,withoutNan,indicies);
+    pcl::compute3DCentroid(objectCloud, massCenter);
+    return withoutNan.points.size();
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    if(iterations < 1) iterations = 1;
+
+    Cloud cloud;
+    makeCloud(cloud);
+
+    //Sizes around the minArea/maxArea thresholds of settings.yaml
+    std::vector<cv::Size> axes;
+    axes.push_back(cv::Size(20, 16));
+    axes.push_back(cv::Size(35, 25));
+    axes.push_back(cv::Size(50, 35));
+    axes.push_back(cv::Size(120, 90));
+
+    contour_extractor extractor;
+    const organized_cloud_view view(cloud);
+    const double tickMs = 1000.0 / cv::getTickFrequency();
+
+    printf("%-12s %10s %8s %14s %14s %9s %12s\n", "axes", "area", "points", "legacy [ms]", "raster [ms]", "speedup", "centroid err");
+    for(size_t i = 0; i < axes.size(); ++i) {
+        std::vector<cv::Point> contour = makeContour(cv::Point(cols/2, rows/2 + 60), axes[i]);
+        double area = cv::contourArea(contour);
+
+        Eigen::Vector4f legacyCenter;
+        size_t legacyPoints = 0;
+        int64 start = cv::getTickCount();
+        for(int it = 0; it < iterations; ++it) {
+            legacyPoints = legacyExtract(contour, cloud, legacyCenter);
+        }
+        double legacyMs = (cv::getTickCount() - start) * tickMs / iterations;
+
+        size_t rasterPoints = 0;
+        start = cv::getTickCount();
+        for(int it = 0; it < iterations; ++it) {
+            rasterPoints = extractor.extract(contour, view);
+        }
+        double rasterMs = (cv::getTickCount() - start) * tickMs / iterations;
+
+        float centroidError = (legacyCenter.head<3>() - extractor.centroid().head<3>()).norm();
+        char label[32];
+        snprintf(label, sizeof(label), "%dx%d", axes[i].width, axes[i].height);
+        printf("%-12s %10.0f %8d %14.3f %14.3f %8.1fx %12.2e\n", label, area, int(rasterPoints),
+               legacyMs, rasterMs, legacyMs / rasterMs, centroidError);
+        if(legacyPoints != rasterPoints) {
+            printf("  point count differs: legacy %d, raster %d\n", int(legacyPoints), int(rasterPoints));
+        }
+    }
+    return 0;
+}
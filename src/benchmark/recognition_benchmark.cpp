@@ -0,0 +1,271 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+#include <object_recognition/object_classifier.h>
+#include <object_recognition/sample_pack.h>
+#include "benchmark_data.h"
+
+//Recognition accuracy, training time, model size and query latency over the
+//bundled data sets, for every combination of the swept parameters. Needs no
+//camera or roscore. The results are written as one JSON document, so the runs
+//of two builds can be compared by a script.
+//
+//Usage: recognition_benchmark [options]
+//  --train dir         training images or a sample pack, default sample_images/
+//  --heldout dir       classify the HSV crops in dir with the model trained on --train,
+//                      labeled like replay_benchmark --images does. Can be given more
+//                      than once, default test_images/ and temptestimages/
+//  --samplesize list   sample sizes to sweep, like 50x50,100x100, default 100x100
+//  --pcaaccuracy list  retained variances to sweep, like 0.9,0.99, default 0.99
+//  --neighbors list    neighbor counts to sweep, like 3,7, default 7
+//  --index type        neighbor index: bruteforce (default), vptree or hnsw
+//  --pcatrainer type   full (default) or truncated, see classifier_params
+//  --nocascade         run the PCA and the KNN search on every held out crop
+//  --noloo             skip the leave-one-out evaluation of the training set
+//  --output file       where the JSON goes, default recognition_benchmark.json
+//
+//A run whose training fails gets an entry with an "error" and the sweep goes on,
+//the exit code is 1 then.
+//
+//Leave-one-out classifies every training sample by all others. The PCA is
+//trained once per run, so the left out sample is part of the basis, but not of
+//its own neighbors. The cascade is not used for it.
+
+namespace {
+    std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> items;
+        std::stringstream ss(list);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            if(!item.empty()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    std::string jsonString(const std::string& s) {
+        std::string quoted = "\"";
+        for(size_t i = 0; i < s.size(); ++i) {
+            if(s[i] == '"' || s[i] == '\\') {
+                quoted += '\\';
+            }
+            quoted += s[i];
+        }
+        return quoted + "\"";
+    }
+
+    //Rows are the expected classes, columns the answers with one more for no answer
+    struct evaluation {
+        explicit evaluation(int classes) :
+            confusion(classes, std::vector<int>(classes + 1, 0)), correct(0), total(0)
+        {
+        }
+
+        void add(int expected, int answer) {
+            const int classes = int(confusion.size());
+            if(answer < 0 || answer >= classes) {
+                answer = classes;
+            }
+            ++confusion[expected][answer];
+            correct += expected == answer;
+            ++total;
+        }
+
+        void write(FILE* out) const {
+            fprintf(out, "{\"accuracy\": %.4f, \"correct\": %d, \"total\": %d, \"confusion\": [",
+                    total > 0 ? double(correct) / total : 0.0, correct, total);
+            for(size_t i = 0; i < confusion.size(); ++i) {
+                fprintf(out, "%s[", i > 0 ? ", " : "");
+                for(size_t j = 0; j < confusion[i].size(); ++j) {
+                    fprintf(out, "%s%d", j > 0 ? ", " : "", confusion[i][j]);
+                }
+                fprintf(out, "]");
+            }
+            fprintf(out, "]}");
+        }
+
+        std::vector<std::vector<int> > confusion;
+        int correct, total;
+    };
+
+    //The class whose name is the longest one in expected, -1 for none
+    int expectedClass(const std::string& expected, const std::map<int, std::string>& labels, int classes) {
+        int best = -1;
+        size_t length = 0;
+        for(std::map<int, std::string>::const_iterator i = labels.begin(); i != labels.end(); ++i) {
+            if(i->first < classes && i->second.size() > length && expected.find(i->second) != std::string::npos) {
+                best = i->first;
+                length = i->second.size();
+            }
+        }
+        return best;
+    }
+
+    struct run_params {
+        int sampleWidth, sampleHeight;
+        float pcaAccuracy;
+        int neighbors;
+    };
+}
+
+int main(int argc, char** argv) {
+    std::string trainDir = "sample_images/";
+    std::string output = "recognition_benchmark.json";
+    std::string indexType = "bruteforce";
+    std::string pcaTrainer = "full";
+    std::vector<std::string> heldOutDirs;
+    std::vector<std::string> sampleSizes(1, "100x100"), pcaAccuracies(1, "0.99"), neighborCounts(1, "7");
+    bool cascade = true, leaveOneOut = true;
+    for(int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if(!strcmp(argv[i], "--train") && hasValue) trainDir = argv[++i];
+        else if(!strcmp(argv[i], "--heldout") && hasValue) heldOutDirs.push_back(argv[++i]);
+        else if(!strcmp(argv[i], "--samplesize") && hasValue) sampleSizes = split(argv[++i]);
+        else if(!strcmp(argv[i], "--pcaaccuracy") && hasValue) pcaAccuracies = split(argv[++i]);
+        else if(!strcmp(argv[i], "--neighbors") && hasValue) neighborCounts = split(argv[++i]);
+        else if(!strcmp(argv[i], "--index") && hasValue) indexType = argv[++i];
+        else if(!strcmp(argv[i], "--pcatrainer") && hasValue) pcaTrainer = argv[++i];
+        else if(!strcmp(argv[i], "--nocascade")) cascade = false;
+        else if(!strcmp(argv[i], "--noloo")) leaveOneOut = false;
+        else if(!strcmp(argv[i], "--output") && hasValue) output = argv[++i];
+        else {
+            printf("unknown argument %s, see the top of recognition_benchmark.cpp\n", argv[i]);
+            return 1;
+        }
+    }
+    if(heldOutDirs.empty()) {
+        heldOutDirs.push_back("test_images/");
+        heldOutDirs.push_back("temptestimages/");
+    }
+
+    std::vector<run_params> runs;
+    for(size_t s = 0; s < sampleSizes.size(); ++s) {
+        run_params run;
+        if(sscanf(sampleSizes[s].c_str(), "%dx%d", &run.sampleWidth, &run.sampleHeight) != 2 ||
+           run.sampleWidth <= 0 || run.sampleHeight <= 0) {
+            printf("sample size %s is not like 100x100\n", sampleSizes[s].c_str());
+            return 1;
+        }
+        for(size_t p = 0; p < pcaAccuracies.size(); ++p) {
+            run.pcaAccuracy = float(atof(pcaAccuracies[p].c_str()));
+            for(size_t n = 0; n < neighborCounts.size(); ++n) {
+                run.neighbors = std::max(1, atoi(neighborCounts[n].c_str()));
+                runs.push_back(run);
+            }
+        }
+    }
+
+    std::vector<cv::Mat> crops;
+    std::vector<std::string> expected;
+    sample_pack pack;
+    for(size_t i = 0; i < heldOutDirs.size(); ++i) {
+        if(pack.open(heldOutDirs[i])) {
+            loadCrops(pack, crops, expected);
+        } else {
+            std::vector<std::pair<std::string, std::string> > images;
+            listImages(heldOutDirs[i], images);
+            loadCrops(images, crops, expected);
+        }
+    }
+    const std::string trainPath = pack.open(trainDir) ? trainDir : withSlash(trainDir);
+
+    FILE* out = fopen(output.c_str(), "w");
+    if(!out) {
+        printf("could not write %s\n", output.c_str());
+        return 1;
+    }
+    fprintf(out, "{\n\"train\": %s,\n\"index\": %s,\n\"pcaTrainer\": %s,\n\"cascade\": %s,\n\"runs\": [\n",
+            jsonString(trainDir).c_str(), jsonString(indexType).c_str(), jsonString(pcaTrainer).c_str(),
+            cascade ? "true" : "false");
+    bool failed = false;
+    for(size_t r = 0; r < runs.size(); ++r) {
+        const run_params& run = runs[r];
+        classifier_params params;
+        params.sampleWidth = run.sampleWidth;
+        params.sampleHeight = run.sampleHeight;
+        params.pcaAccuracy = run.pcaAccuracy;
+        params.neighborCount = run.neighbors;
+        params.loadPca = false;
+        params.pcaTrainer = pcaTrainer;
+        params.index.type = indexType;
+        params.cascade.enabled = cascade;
+        object_classifier classifier(params);
+        const int64 start = cv::getTickCount();
+        const bool trained = classifier.train(trainPath);
+        const double trainingSeconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+        fprintf(out, "%s{\"sampleWidth\": %d, \"sampleHeight\": %d, \"pcaAccuracy\": %g, \"neighbors\": %d,\n",
+                r > 0 ? ",\n" : "", run.sampleWidth, run.sampleHeight, run.pcaAccuracy, run.neighbors);
+        if(!trained) {
+            fprintf(out, " \"error\": \"training failed\"}");
+            printf("%dx%d pca %g k %d: training failed\n", run.sampleWidth, run.sampleHeight, run.pcaAccuracy, run.neighbors);
+            failed = true;
+            continue;
+        }
+        const std::map<int, std::string> labels = classifier.labels();
+        const int classes = labels.empty() ? 0 : labels.rbegin()->first + 1;
+        const int samples = classifier.index()->size(), components = classifier.index()->dims();
+        const int inputs = run.sampleWidth * run.sampleHeight * params.attributes;
+        //The matrices and labels of the model cache, without the names
+        const long modelBytes = sizeof(float) * (long(inputs) * (components + 1) + components + long(samples) * components) +
+                                sizeof(boost::int32_t) * long(samples) +
+                                sizeof(float) * long(classes) * color_cascade(params.cascade).featureLength();
+        fprintf(out, " \"trainingSeconds\": %.4f, \"samples\": %d, \"components\": %d, \"modelBytes\": %ld,\n",
+                trainingSeconds, samples, components, modelBytes);
+        fprintf(out, " \"classes\": [");
+        for(int c = 0; c < classes; ++c) {
+            std::map<int, std::string>::const_iterator name = labels.find(c);
+            fprintf(out, "%s%s", c > 0 ? ", " : "", jsonString(name != labels.end() ? name->second : "").c_str());
+        }
+        fprintf(out, "]");
+
+        double looAccuracy = -1;
+        if(leaveOneOut) {
+            std::vector<int> looExpected;
+            std::vector<classification_result> looResults;
+            classifier.leaveOneOut(looExpected, looResults);
+            evaluation loo(classes);
+            for(size_t i = 0; i < looResults.size(); ++i) {
+                if(looExpected[i] >= 0 && looExpected[i] < classes) {
+                    loo.add(looExpected[i], looResults[i].label);
+                }
+            }
+            fprintf(out, ",\n \"leaveOneOut\": ");
+            loo.write(out);
+            looAccuracy = loo.total > 0 ? double(loo.correct) / loo.total : 0.0;
+        }
+
+        evaluation heldOut(classes);
+        stage_samples latency;
+        classification_result result;
+        for(size_t i = 0; i < crops.size(); ++i) {
+            const int64 query = cv::getTickCount();
+            classifier.classify(crops[i], result);
+            latency.add((cv::getTickCount() - query) * 1000.0 / cv::getTickFrequency());
+            const int expectedLabel = expectedClass(expected[i], labels, classes);
+            if(expectedLabel >= 0) {
+                heldOut.add(expectedLabel, result.label);
+            }
+        }
+        fprintf(out, ",\n \"heldOut\": ");
+        heldOut.write(out);
+        fprintf(out, ",\n \"latencyMs\": {\"count\": %d, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}}",
+                int(latency.count()), latency.mean(), latency.percentile(0.5), latency.percentile(0.9),
+                latency.percentile(0.99), latency.percentile(1.0));
+
+        printf("%dx%d pca %g k %d: training %.3f s, %d components, %ld bytes, leave-one-out %.1f %%, held out %d / %d, p50 %.3f ms\n",
+               run.sampleWidth, run.sampleHeight, run.pcaAccuracy, run.neighbors, trainingSeconds, components, modelBytes,
+               100.0 * looAccuracy, heldOut.correct, heldOut.total, latency.percentile(0.5));
+    }
+    fprintf(out, "\n]\n}\n");
+    fclose(out);
+    printf("wrote %s\n", output.c_str());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,386 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/types.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/io/pcd_io.h>
+
+#include <object_recognition/object_detector.h>
+#include <object_recognition/object_classifier.h>
+#include <object_recognition/sample_pack.h>
+#include "benchmark_data.h"
+
+//Replays recorded data through the detection and recognition core without a
+//camera or roscore and reports the throughput and latency percentiles per stage.
+//
+//Usage: replay_benchmark [options]
+//  --settings file   object_detection parameters, default launch/settings.yaml
+//  --train dir       training images or a sample pack, default sample_images/
+//  --pca file        load the PCA from file instead of computing it
+//  --model file      model cache, trained once and mapped on the next runs
+//  --threads n       threads loading the training images, default one per core
+//  --index type      neighbor index: bruteforce (default), vptree or hnsw
+//  --quantized       store the training samples as int8 in the index
+//  --kernel name     distance kernel: avx2, sse2 or scalar, default the best one
+//                    the CPU supports
+//  --images dir      classify the HSV crops in dir, files directly in dir are labeled
+//                    by their name (test_images/), files in subdirectories by the
+//                    subdirectory (sample_images/). dir can also be a sample pack
+//                    of pack_samples. Can be given more than once.
+//  --frames dir      run the detection on the organized XYZRGB .pcd files in dir.
+//                    An optional camera_to_robot.txt in dir holds the row major 4x4
+//                    transform, otherwise the clouds are taken to be in the robot frame.
+//                    Can be given more than once.
+//  --repeat n        replay everything n times, default 1
+//  --fused           classify with the fused preprocessing instead of the reference one
+//  --batch n         classify n crops at a time with classifyBatch(), default 1
+//  --nocascade       run the PCA and the KNN search on every crop, without the color cascade
+//  --compare         compare the fused preprocessing with the reference on every crop
+
+void printHeader(const char* title, int count, double seconds) {
+    printf("%s: %d in %.3f s, %.1f per second\n", title, count, seconds, seconds > 0 ? count / seconds : 0.0);
+    printf("  %-12s %8s %9s %9s %9s %9s %9s  [ms]\n", "stage", "count", "mean", "p50", "p90", "p99", "max");
+}
+
+//Reads the nested "key: value" maps of a ROS parameter file, which is all
+//settings.yaml uses. Keys are joined with '/', like ROS parameter names.
+std::map<std::string, std::string> readSettings(const std::string& path) {
+    std::map<std::string, std::string> values;
+    std::ifstream file(path.c_str());
+    std::vector<std::pair<int, std::string> > parents;
+    std::string line;
+    while(std::getline(file, line)) {
+        const size_t comment = line.find('#');
+        if(comment != std::string::npos) line.erase(comment);
+        const size_t indent = line.find_first_not_of(' ');
+        const size_t colon = line.find(':');
+        if(indent == std::string::npos || colon == std::string::npos) {
+            continue;
+        }
+        while(!parents.empty() && parents.back().first >= int(indent)) {
+            parents.pop_back();
+        }
+        std::string key = line.substr(indent, colon - indent);
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(" \r") + 1);
+
+        std::string name;
+        for(size_t i = 0; i < parents.size(); ++i) {
+            name += parents[i].second + "/";
+        }
+        if(value.empty()) {
+            parents.push_back(std::make_pair(int(indent), key));
+        } else {
+            values[name + key] = value;
+        }
+    }
+    return values;
+}
+
+template <typename T> void setting(const std::map<std::string, std::string>& values, const std::string& name, T& variable) {
+    std::map<std::string, std::string>::const_iterator it = values.find("object_detection/" + name);
+    if(it == values.end()) {
+        return;
+    }
+    if(it->second == "true" || it->second == "false") {
+        std::istringstream(it->second == "true" ? "1" : "0") >> variable;
+    } else {
+        std::istringstream(it->second) >> variable;
+    }
+}
+
+//Same parameters and defaults as object_detection::loadParams()
+detector_params loadDetectorParams(const std::string& path) {
+    const std::map<std::string, std::string> values = readSettings(path);
+    detector_params params;
+    setting(values, "crop/wMin", params.cropMin[0]);
+    setting(values, "crop/dMin", params.cropMin[1]);
+    setting(values, "crop/hMin", params.cropMin[2]);
+    setting(values, "crop/wMax", params.cropMax[0]);
+    setting(values, "crop/dMax", params.cropMax[1]);
+    setting(values, "crop/hMax", params.cropMax[2]);
+    setting(values, "roi/x", params.roi.x);
+    setting(values, "roi/y", params.roi.y);
+    setting(values, "roi/width", params.roi.width);
+    setting(values, "roi/height", params.roi.height);
+    setting(values, "rectPadding", params.rectPadding);
+    setting(values, "heightCorrection", params.heightCorrection);
+    setting(values, "minArea", params.areaMin);
+    setting(values, "maxArea", params.areaMax);
+    setting(values, "tracking/enabled", params.tracking);
+    setting(values, "tracking/padding", params.trackingPadding);
+    setting(values, "tracking/refreshInterval", params.trackingRefresh);
+    setting(values, "pyramid/scale", params.pyramidScale);
+
+    params.ranges.resize(6);
+    for(size_t i = 0; i < params.ranges.size(); ++i) {
+        std::stringstream ss; ss << "hsv" << i << "/";
+        hsv_range& range = params.ranges[i];
+        range.setValues(10, 10, 10, 180, 255, 255);
+        setting(values, ss.str() + "hmin", range.hmin);
+        setting(values, ss.str() + "smin", range.smin);
+        setting(values, ss.str() + "vmin", range.vmin);
+        setting(values, ss.str() + "hmax", range.hmax);
+        setting(values, ss.str() + "smax", range.smax);
+        setting(values, ss.str() + "vmax", range.vmax);
+        setting(values, ss.str() + "color", range.color);
+        setting(values, ss.str() + "inverted", range.inverted);
+        setting(values, ss.str() + "includeinvalid", range.includeInvalid);
+    }
+    return params;
+}
+
+//How far preprocessFused() is from preprocess(): the mean absolute difference
+//of the feature rows, the largest difference of the projections relative to
+//the length of the reference projection, and how often the labels agree
+void comparePreprocessing(object_classifier& classifier, const std::vector<cv::Mat>& crops) {
+    cv::Mat sample, reference, fused, referencePca, fusedPca;
+    classification_result referenceResult, fusedResult;
+    double rowDifference = 0, maxPcaDifference = 0;
+    int agree = 0;
+    for(size_t i = 0; i < crops.size(); ++i) {
+        classifier.preprocess(crops[i], sample, reference);
+        classifier.preprocessFused(crops[i], sample, fused);
+        rowDifference += cv::norm(reference, fused, cv::NORM_L1) / reference.cols;
+        classifier.project(reference, referencePca);
+        classifier.project(fused, fusedPca);
+        maxPcaDifference = std::max(maxPcaDifference, cv::norm(referencePca, fusedPca) / std::max(1e-6, cv::norm(referencePca)));
+        classifier.classifyRow(reference, referenceResult);
+        classifier.classifyRow(fused, fusedResult);
+        agree += referenceResult.label == fusedResult.label;
+    }
+    if(!crops.empty()) {
+        printf("fused preprocessing: mean row difference %.3f, max relative projection difference %.4f, same label %d / %d\n",
+               rowDifference / crops.size(), maxPcaDifference, agree, int(crops.size()));
+    }
+}
+
+//With batch > 1 the crops are classified batch by batch and the stage
+//latencies are per batch
+void replayImages(object_classifier& classifier, const std::vector<cv::Mat>& crops, const std::vector<std::string>& expected,
+                  int repeat, int batch) {
+    if(crops.empty()) {
+        printf("classification: no images\n");
+        return;
+    }
+
+    stage_samples preprocess, cascade, projection, knn, total;
+    int correct = 0, labeled = 0, cascaded = 0;
+    std::vector<classification_result> results(1);
+    std::vector<cv::Mat> batchCrops;
+    const std::map<int, std::string> labels = classifier.labels();
+    const int64 start = cv::getTickCount();
+    for(int r = 0; r < repeat; ++r) {
+        for(size_t first = 0; first < crops.size(); first += batch) {
+            const size_t end = std::min(crops.size(), first + batch);
+            if(batch > 1) {
+                batchCrops.assign(crops.begin() + first, crops.begin() + end);
+                classifier.classifyBatch(batchCrops, results);
+            } else {
+                classifier.classify(crops[first], results[0]);
+            }
+            const classification_timings& t = classifier.timings();
+            preprocess.add(t.preprocess);
+            cascade.add(t.cascade);
+            projection.add(t.projection);
+            knn.add(t.knn);
+            total.add(t.total);
+            if(r > 0 || labels.empty()) {
+                continue;
+            }
+            for(size_t i = first; i < end; ++i) {
+                const classification_result& result = results[i - first];
+                cascaded += result.cascade;
+                //test_images are named like the class, possibly with a suffix
+                bool known = false;
+                for(std::map<int, std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it) {
+                    known |= expected[i].find(it->second) != std::string::npos;
+                }
+                if(known) {
+                    ++labeled;
+                    correct += !result.name.empty() && expected[i].find(result.name) != std::string::npos;
+                }
+            }
+        }
+    }
+    const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    printHeader(batch > 1 ? "classification (latencies per batch)" : "classification", int(crops.size()) * repeat, seconds);
+    preprocess.print("preprocess");
+    cascade.print("cascade");
+    projection.print("projection");
+    knn.print("knn");
+    total.print("total");
+    printf("  answered by the cascade %d / %d\n", cascaded, int(crops.size()));
+    if(labeled > 0) {
+        printf("  accuracy %d / %d = %.1f %%\n", correct, labeled, 100.0 * correct / labeled);
+    }
+}
+
+Eigen::Affine3f readTransform(const std::string& path) {
+    Eigen::Affine3f transform = Eigen::Affine3f::Identity();
+    std::ifstream file(path.c_str());
+    Eigen::Matrix4f m;
+    for(int i = 0; i < 16; ++i) {
+        if(!(file >> m(i / 4, i % 4))) {
+            return transform;
+        }
+    }
+    transform.matrix() = m;
+    return transform;
+}
+
+void replayFrames(object_detector& detector, const std::vector<std::string>& frameDirs, int repeat) {
+    stage_samples depth, blur, labeling, contours, extraction, total;
+    int frames = 0, objects = 0;
+    double seconds = 0;
+    for(size_t d = 0; d < frameDirs.size(); ++d) {
+        const std::string dir = withSlash(frameDirs[d]);
+        detection_input input;
+        input.cameraToRobot = readTransform(dir + "camera_to_robot.txt");
+
+        std::vector<std::string> files = listFiles(dir, false);
+        for(size_t i = 0; i < files.size(); ++i) {
+            if(files[i].size() < 4 || files[i].compare(files[i].size() - 4, 4, ".pcd") != 0) {
+                continue;
+            }
+            pcl::PointCloud<pcl::PointXYZRGB> cloud;
+            if(pcl::io::loadPCDFile(dir + files[i], cloud) < 0 || cloud.height < 2) {
+                printf("skipping %s, not an organized XYZRGB cloud\n", files[i].c_str());
+                continue;
+            }
+            input.cloud = organized_cloud_view(cloud);
+            input.cloud.bgrImage(input.image);
+
+            std::vector<detected_object> found;
+            detector.resetTracking();
+            for(int r = 0; r < repeat; ++r) {
+                const int64 start = cv::getTickCount();
+                detector.detect(input, found);
+                seconds += (cv::getTickCount() - start) / cv::getTickFrequency();
+                const detection_timings& t = detector.timings();
+                depth.add(t.depth);
+                blur.add(t.blur);
+                labeling.add(t.labeling);
+                contours.add(t.contours);
+                extraction.add(t.extraction);
+                total.add(t.total);
+                ++frames;
+                objects += found.size();
+            }
+        }
+    }
+    if(frames == 0) {
+        printf("detection: no frames\n");
+        return;
+    }
+    printHeader("detection", frames, seconds);
+    depth.print("depth");
+    blur.print("blur+hsv");
+    labeling.print("labeling");
+    contours.print("contours");
+    extraction.print("extraction");
+    total.print("total");
+    printf("  %.2f objects per frame\n", double(objects) / frames);
+}
+
+int main(int argc, char** argv) {
+    std::string settings = "launch/settings.yaml";
+    std::string trainDir = "sample_images/";
+    std::string pcaFile, modelFile;
+    std::string indexType = "bruteforce";
+    bool quantized = false;
+    int loaderThreads = 0;
+    bool fused = false, compare = false, cascade = true;
+    int batch = 1;
+    std::vector<std::string> imageDirs, frameDirs;
+    int repeat = 1;
+    for(int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if(!strcmp(argv[i], "--settings") && hasValue) settings = argv[++i];
+        else if(!strcmp(argv[i], "--train") && hasValue) trainDir = argv[++i];
+        else if(!strcmp(argv[i], "--pca") && hasValue) pcaFile = argv[++i];
+        else if(!strcmp(argv[i], "--model") && hasValue) modelFile = argv[++i];
+        else if(!strcmp(argv[i], "--threads") && hasValue) loaderThreads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--index") && hasValue) indexType = argv[++i];
+        else if(!strcmp(argv[i], "--quantized")) quantized = true;
+        else if(!strcmp(argv[i], "--kernel") && hasValue) {
+            if(!setDistanceKernel(argv[++i])) {
+                printf("distance kernel %s is not available\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(!strcmp(argv[i], "--images") && hasValue) imageDirs.push_back(argv[++i]);
+        else if(!strcmp(argv[i], "--frames") && hasValue) frameDirs.push_back(argv[++i]);
+        else if(!strcmp(argv[i], "--repeat") && hasValue) repeat = std::max(1, atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--fused")) fused = true;
+        else if(!strcmp(argv[i], "--compare")) compare = true;
+        else if(!strcmp(argv[i], "--batch") && hasValue) batch = std::max(1, atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--nocascade")) cascade = false;
+        else {
+            printf("unknown argument %s, see the top of replay_benchmark.cpp\n", argv[i]);
+            return 1;
+        }
+    }
+    if(imageDirs.empty() && frameDirs.empty()) {
+        imageDirs.push_back("test_images/");
+        imageDirs.push_back("sample_images/");
+    }
+
+    if(!imageDirs.empty()) {
+        classifier_params params;
+        params.pcaFile = pcaFile;
+        params.loadPca = !pcaFile.empty();
+        params.modelFile = modelFile;
+        params.loaderThreads = loaderThreads;
+        params.fusedPreprocess = fused;
+        params.cascade.enabled = cascade;
+        params.index.type = indexType;
+        params.index.quantized = quantized;
+        printf("distance kernel: %s%s\n", distanceKernel(), quantized ? ", int8 samples" : "");
+        object_classifier classifier(params);
+        const int64 start = cv::getTickCount();
+        sample_pack pack;
+        if(!classifier.train(pack.open(trainDir) ? trainDir : withSlash(trainDir))) {
+            return 1;
+        }
+        printf("training: %.3f s\n", (cv::getTickCount() - start) / cv::getTickFrequency());
+
+        std::vector<cv::Mat> crops;
+        std::vector<std::string> expected;
+        for(size_t i = 0; i < imageDirs.size(); ++i) {
+            if(pack.open(imageDirs[i])) {
+                loadCrops(pack, crops, expected);
+            } else {
+                std::vector<std::pair<std::string, std::string> > images;
+                listImages(imageDirs[i], images);
+                loadCrops(images, crops, expected);
+            }
+        }
+        if(compare) {
+            comparePreprocessing(classifier, crops);
+        }
+        replayImages(classifier, crops, expected, repeat, batch);
+    }
+
+    if(!frameDirs.empty()) {
+        object_detector detector;
+        if(!detector.configure(loadDetectorParams(settings))) {
+            printf("only the first %d hsv ranges are used\n", hsv_label_table::maxClasses);
+        }
+        replayFrames(detector, frameDirs, repeat);
+    }
+    return 0;
+}
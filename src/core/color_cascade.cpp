@@ -0,0 +1,140 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <object_recognition/color_cascade.h>
+
+const int color_cascade::shapeFeatures;
+
+void color_cascade::features(const cv::Mat& hsvSample, float* out) const {
+    const int hueBins = params_.hueBins, saturationBins = params_.saturationBins;
+    const int bins = hueBins * saturationBins;
+    std::fill_n(out, featureLength(), 0.0f);
+    //Hue is 0..179 in OpenCV, the last bins take what does not divide evenly
+    double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+    int colored = 0;
+    for(int y = 0; y < hsvSample.rows; ++y) {
+        const cv::Vec3b* pixel = hsvSample.ptr<cv::Vec3b>(y);
+        for(int x = 0; x < hsvSample.cols; ++x) {
+            const int saturation = pixel[x][1];
+            if(saturation < params_.minSaturation) {
+                continue;
+            }
+            const int h = std::min(hueBins - 1, pixel[x][0] * hueBins / 180);
+            const int s = std::min(saturationBins - 1, saturation * saturationBins / 256);
+            out[h * saturationBins + s] += 1;
+            ++colored;
+            m00 += 1;
+            m10 += x;
+            m01 += y;
+            m20 += double(x) * x;
+            m11 += double(x) * y;
+            m02 += double(y) * y;
+        }
+    }
+    if(colored == 0) {
+        return;
+    }
+    for(int i = 0; i < bins; ++i) {
+        out[i] /= colored;
+    }
+    //Hu's first two invariants of the mask, from its normalized central moments
+    const double cx = m10 / m00, cy = m01 / m00;
+    const double mu20 = m20 / m00 - cx * cx, mu02 = m02 / m00 - cy * cy, mu11 = m11 / m00 - cx * cy;
+    const double eta20 = mu20 / m00, eta02 = mu02 / m00, eta11 = mu11 / m00;
+    float* shape = out + bins;
+    shape[0] = float(colored) / hsvSample.total();
+    shape[1] = float(eta20 + eta02);
+    shape[2] = float(std::sqrt((eta20 - eta02) * (eta20 - eta02) + 4 * eta11 * eta11));
+}
+
+cv::Mat color_cascade::prototypes(const cv::Mat& features, const std::vector<int>& labels, int classes) const {
+    cv::Mat prototypes = cv::Mat::zeros(classes, featureLength(), CV_32FC1);
+    std::vector<int> counts(classes, 0);
+    for(int i = 0; i < features.rows; ++i) {
+        const int label = labels[i];
+        if(label < 0 || label >= classes) {
+            continue;
+        }
+        cv::add(prototypes.row(label), features.row(i), prototypes.row(label));
+        ++counts[label];
+    }
+    for(int i = 0; i < classes; ++i) {
+        if(counts[i] > 0) {
+            cv::Mat row = prototypes.row(i);
+            row /= counts[i];
+        }
+    }
+    return prototypes;
+}
+
+void color_cascade::setPrototypes(const cv::Mat& prototypes, const std::vector<int>& labels) {
+    //A copy, the prototypes may point into a mapped model and add() changes them
+    prototypes.copyTo(prototypes_);
+    counts_.assign(prototypes_.rows, 0);
+    for(size_t i = 0; i < labels.size(); ++i) {
+        if(labels[i] >= 0 && labels[i] < prototypes_.rows) {
+            ++counts_[labels[i]];
+        }
+    }
+}
+
+void color_cascade::add(int label, const float* feature) {
+    if(label < 0) {
+        return;
+    }
+    if(label >= prototypes_.rows) {
+        cv::Mat grown = cv::Mat::zeros(label + 1, featureLength(), CV_32FC1);
+        if(!prototypes_.empty()) {
+            prototypes_.copyTo(grown.rowRange(0, prototypes_.rows));
+        }
+        prototypes_ = grown;
+        counts_.resize(label + 1, 0);
+    }
+    //Running mean
+    float* prototype = prototypes_.ptr<float>(label);
+    const float weight = 1.0f / ++counts_[label];
+    for(int i = 0; i < prototypes_.cols; ++i) {
+        prototype[i] += (feature[i] - prototype[i]) * weight;
+    }
+}
+
+int color_cascade::match(const float* feature, const std::vector<char>& allowed, float& distance, float& confidence) const {
+    float best = std::numeric_limits<float>::max(), second = std::numeric_limits<float>::max();
+    int label = -1;
+    for(int i = 0; i < prototypes_.rows; ++i) {
+        if(counts_[i] == 0) {
+            continue;
+        }
+        const float d = this->distance(feature, prototypes_.ptr<float>(i));
+        if(d < best) {
+            second = best;
+            best = d;
+            label = i;
+        } else if(d < second) {
+            second = d;
+        }
+    }
+    distance = best;
+    //Without a second class the margin is taken to where one would stop the match
+    const float other = second < std::numeric_limits<float>::max() ? second : params_.margin * params_.acceptDistance;
+    confidence = other > 0 ? std::max(0.0f, 1.0f - best / other) : 0.0f;
+    if(label < 0 || best > params_.acceptDistance || second < params_.margin * best) {
+        return -1;
+    }
+    if(!allowed.empty() && (label >= int(allowed.size()) || !allowed[label])) {
+        return -1;
+    }
+    return label;
+}
+
+float color_cascade::distance(const float* a, const float* b) const {
+    const int bins = params_.hueBins * params_.saturationBins;
+    float histogram = 0, shape = 0;
+    for(int i = 0; i < bins; ++i) {
+        histogram += std::abs(a[i] - b[i]);
+    }
+    for(int i = bins; i < bins + shapeFeatures; ++i) {
+        shape += std::abs(a[i] - b[i]);
+    }
+    return histogram + params_.shapeWeight * shape;
+}
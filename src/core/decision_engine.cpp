@@ -0,0 +1,149 @@
+#include <cmath>
+#include <map>
+#include <algorithm>
+#include <object_recognition/decision_engine.h>
+
+namespace {
+    //The confidence of result is in its own label. A frame added with another
+    //one, like -1 after the color check failed, has none.
+    float frameConfidence(int label, const classification_result& result) {
+        return label == result.label ? classificationConfidence(result) : 0.0f;
+    }
+
+    //The same label a number of times in a row
+    class consecutive_engine : public decision_engine {
+    public:
+        explicit consecutive_engine(int confirmations) : confirmations_(std::max(1, confirmations)) { reset(); }
+
+        bool add(int label, const classification_result& result, double time, decision& decided) {
+            if(frames_ == 0) {
+                firstTime_ = time;
+            }
+            ++frames_;
+            run_ = (run_ > 0 && label == label_) ? run_ + 1 : 1;
+            label_ = label;
+            if(run_ < confirmations_) {
+                return false;
+            }
+            decided.label = label;
+            decided.confidence = frameConfidence(label, result);
+            decided.frames = frames_;
+            decided.firstTime = firstTime_;
+            reset();
+            return true;
+        }
+
+        void reset() {
+            label_ = -1;
+            run_ = 0;
+            frames_ = 0;
+            firstTime_ = 0;
+        }
+
+    private:
+        int confirmations_;
+        int label_, run_, frames_;
+        double firstTime_;
+    };
+
+    //Sums the confidence of every label over a sliding window of frames
+    class confidence_engine : public decision_engine {
+    public:
+        explicit confidence_engine(const decision_params& params) : params_(params) {
+            params_.window = std::max(1, params_.window);
+            reset();
+        }
+
+        bool add(int label, const classification_result& result, double time, decision& decided) {
+            if(frames_ == 0) {
+                firstTime_ = time;
+            }
+            ++frames_;
+            //A cascade answer has no neighbors to vote, only its confidence counts.
+            //A frame whose label is not the classified one has no confidence.
+            const int neighbors = int(result.neighborLabels.size());
+            const bool noise = label != result.label ||
+                               (!result.cascade && (neighbors == 0 || result.votes < params_.minVotes * neighbors));
+            //Noise still takes its place in the window, so it pushes older frames out
+            window_.push_back(frame(label, noise ? 0.0f : classificationConfidence(result)));
+            if(int(window_.size()) > params_.window) {
+                window_.pop_front();
+            }
+            if(noise) {
+                return false;
+            }
+
+            std::map<int, float> scores;
+            float total = 0;
+            for(std::deque<frame>::const_iterator i = window_.begin(); i != window_.end(); ++i) {
+                scores[i->first] += i->second;
+                total += i->second;
+            }
+            const float score = scores[label];
+            if(score < params_.confirmConfidence || score < params_.agreement * total) {
+                return false;
+            }
+            decided.label = label;
+            decided.confidence = std::min(1.0f, score);
+            decided.frames = frames_;
+            decided.firstTime = firstTime_;
+            reset();
+            return true;
+        }
+
+        void reset() {
+            window_.clear();
+            frames_ = 0;
+            firstTime_ = 0;
+        }
+
+    private:
+        //Label and confidence
+        typedef std::pair<int, float> frame;
+
+        decision_params params_;
+        std::deque<frame> window_;
+        int frames_;
+        double firstTime_;
+    };
+}
+
+decision_engine* decision_engine::create(const decision_params& params) {
+    if(params.type == "consecutive") {
+        return new consecutive_engine(params.confirmations);
+    }
+    if(params.type == "confidence") {
+        return new confidence_engine(params);
+    }
+    return NULL;
+}
+
+float classificationConfidence(const classification_result& result) {
+    if(result.cascade) {
+        return result.cascadeConfidence;
+    }
+    const size_t neighbors = result.neighborLabels.size();
+    if(neighbors == 0 || result.neighborDistances.size() != neighbors) {
+        return 0;
+    }
+    const float votes = float(result.votes) / neighbors;
+    //Nearest first, so the first of each is the nearest
+    float own = -1, other = -1;
+    for(size_t i = 0; i < neighbors && (own < 0 || other < 0); ++i) {
+        float& nearest = result.neighborLabels[i] == result.label ? own : other;
+        if(nearest < 0) {
+            nearest = result.neighborDistances[i];
+        }
+    }
+    if(own < 0) {
+        return 0;
+    }
+    if(other < 0) {
+        return votes;
+    }
+    if(other == 0) {
+        return 0;
+    }
+    const float margin = 1.0f - std::sqrt(own / other);
+    return votes * std::max(0.0f, margin);
+}
@@ -0,0 +1,231 @@
+#include <object_recognition/distance_kernels.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#ifdef OBJECT_RECOGNITION_AVX2_KERNELS
+//distance_kernels_avx2.cpp, the only file built with -mavx2 -mfma
+float squaredDistanceAvx2(const float* a, const float* b, int n);
+float squaredDistanceQuantizedAvx2(const float* a, const signed char* codes, const float* scale, int n);
+void dotProductsAvx2(const float* x, const float* rows, size_t step, int count, int n, float* out);
+#endif
+
+namespace {
+    float squaredDistanceScalar(const float* a, const float* b, int n) {
+        float sum = 0;
+        for(int i = 0; i < n; ++i) {
+            const float d = a[i] - b[i];
+            sum += d*d;
+        }
+        return sum;
+    }
+
+    float squaredDistanceQuantizedScalar(const float* a, const signed char* codes, const float* scale, int n) {
+        float sum = 0;
+        for(int i = 0; i < n; ++i) {
+            const float d = a[i] - codes[i]*scale[i];
+            sum += d*d;
+        }
+        return sum;
+    }
+
+    void dotProductsScalar(const float* x, const float* rows, size_t step, int count, int n, float* out) {
+        int r = 0;
+        for(; r + 4 <= count; r += 4) {
+            const float* r0 = rows + r * step;
+            const float* r1 = r0 + step;
+            const float* r2 = r1 + step;
+            const float* r3 = r2 + step;
+            float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for(int i = 0; i < n; ++i) {
+                s0 += r0[i] * x[i];
+                s1 += r1[i] * x[i];
+                s2 += r2[i] * x[i];
+                s3 += r3[i] * x[i];
+            }
+            out[r] = s0;
+            out[r + 1] = s1;
+            out[r + 2] = s2;
+            out[r + 3] = s3;
+        }
+        for(; r < count; ++r) {
+            const float* row = rows + r * step;
+            float sum = 0;
+            for(int i = 0; i < n; ++i) {
+                sum += row[i] * x[i];
+            }
+            out[r] = sum;
+        }
+    }
+
+#ifdef __SSE2__
+    float horizontalSum(__m128 v) {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,1,1,1)));
+        return _mm_cvtss_f32(v);
+    }
+
+    //Two accumulators hide the latency of the adds
+    float squaredDistanceSse2(const float* a, const float* b, int n) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+            const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+        }
+        float sum = horizontalSum(_mm_add_ps(sum0, sum1));
+        return sum + squaredDistanceScalar(a + i, b + i, n - i);
+    }
+
+    //8 codes per step, sign extended to 32 bit with unpacks since SSE2 has no pmovsx
+    float squaredDistanceQuantizedSse2(const float* a, const signed char* codes, const float* scale, int n) {
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        const __m128i zero = _mm_setzero_si128();
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes + i));
+            const __m128i words = _mm_unpacklo_epi8(bytes, _mm_cmpgt_epi8(zero, bytes));
+            const __m128i sign = _mm_cmpgt_epi16(zero, words);
+            const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, sign));
+            const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, sign));
+            const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_mul_ps(lo, _mm_loadu_ps(scale + i)));
+            const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_mul_ps(hi, _mm_loadu_ps(scale + i + 4)));
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+        }
+        float sum = horizontalSum(_mm_add_ps(sum0, sum1));
+        return sum + squaredDistanceQuantizedScalar(a + i, codes + i, scale + i, n - i);
+    }
+
+    void dotProductsSse2(const float* x, const float* rows, size_t step, int count, int n, float* out) {
+        int r = 0;
+        for(; r + 4 <= count; r += 4) {
+            const float* r0 = rows + r * step;
+            const float* r1 = r0 + step;
+            const float* r2 = r1 + step;
+            const float* r3 = r2 + step;
+            __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+            int i = 0;
+            for(; i + 4 <= n; i += 4) {
+                const __m128 v = _mm_loadu_ps(x + i);
+                s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(r0 + i), v));
+                s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(r1 + i), v));
+                s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(r2 + i), v));
+                s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(r3 + i), v));
+            }
+            float tail[4] = { 0, 0, 0, 0 };
+            for(; i < n; ++i) {
+                tail[0] += r0[i] * x[i];
+                tail[1] += r1[i] * x[i];
+                tail[2] += r2[i] * x[i];
+                tail[3] += r3[i] * x[i];
+            }
+            out[r] = horizontalSum(s0) + tail[0];
+            out[r + 1] = horizontalSum(s1) + tail[1];
+            out[r + 2] = horizontalSum(s2) + tail[2];
+            out[r + 3] = horizontalSum(s3) + tail[3];
+        }
+        dotProductsScalar(x, rows + r * step, step, count - r, n, out + r);
+    }
+#endif
+
+#ifdef OBJECT_RECOGNITION_AVX2_KERNELS
+    bool cpuHasAvx2() {
+#if defined(__i386__) || defined(__x86_64__)
+        unsigned int a, b, c, d;
+        if(!__get_cpuid(1, &a, &b, &c, &d)) {
+            return false;
+        }
+        const bool fma = c & (1u << 12);
+        const bool osxsave = c & (1u << 27);
+        const bool avx = c & (1u << 28);
+        if(!fma || !osxsave || !avx) {
+            return false;
+        }
+        //The OS has to save the ymm registers
+        unsigned int xcr0Low, xcr0High;
+        __asm__ ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+        if((xcr0Low & 6) != 6 || __get_cpuid_max(0, NULL) < 7) {
+            return false;
+        }
+        __cpuid_count(7, 0, a, b, c, d);
+        return b & (1u << 5);
+#else
+        return false;
+#endif
+    }
+#endif
+
+    struct distance_kernels {
+        const char* name;
+        float (*l2)(const float*, const float*, int);
+        float (*l2Quantized)(const float*, const signed char*, const float*, int);
+        void (*dot)(const float*, const float*, size_t, int, int, float*);
+    };
+
+    const distance_kernels scalarKernels = { "scalar", squaredDistanceScalar, squaredDistanceQuantizedScalar, dotProductsScalar };
+#ifdef __SSE2__
+    const distance_kernels sse2Kernels = { "sse2", squaredDistanceSse2, squaredDistanceQuantizedSse2, dotProductsSse2 };
+#endif
+#ifdef OBJECT_RECOGNITION_AVX2_KERNELS
+    const distance_kernels avx2Kernels = { "avx2", squaredDistanceAvx2, squaredDistanceQuantizedAvx2, dotProductsAvx2 };
+#endif
+
+    const distance_kernels* bestKernels() {
+#ifdef OBJECT_RECOGNITION_AVX2_KERNELS
+        if(cpuHasAvx2()) {
+            return &avx2Kernels;
+        }
+#endif
+#ifdef __SSE2__
+        return &sse2Kernels;
+#else
+        return &scalarKernels;
+#endif
+    }
+
+    const distance_kernels* kernels = bestKernels();
+}
+
+float squaredDistance(const float* a, const float* b, int n) {
+    return kernels->l2(a, b, n);
+}
+
+float squaredDistanceQuantized(const float* a, const signed char* codes, const float* scale, int n) {
+    return kernels->l2Quantized(a, codes, scale, n);
+}
+
+void dotProducts(const float* x, const float* rows, size_t step, int count, int n, float* out) {
+    kernels->dot(x, rows, step, count, n, out);
+}
+
+const char* distanceKernel() {
+    return kernels->name;
+}
+
+bool setDistanceKernel(const std::string& name) {
+    if(name == "scalar") {
+        kernels = &scalarKernels;
+        return true;
+    }
+#ifdef __SSE2__
+    if(name == "sse2") {
+        kernels = &sse2Kernels;
+        return true;
+    }
+#endif
+#ifdef OBJECT_RECOGNITION_AVX2_KERNELS
+    if(name == "avx2" && cpuHasAvx2()) {
+        kernels = &avx2Kernels;
+        return true;
+    }
+#endif
+    return false;
+}
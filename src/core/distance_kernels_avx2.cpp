@@ -0,0 +1,84 @@
+//Built with -mavx2 -mfma, only called after distance_kernels.cpp checked the CPU
+#ifdef __AVX2__
+#include <cstddef>
+#include <immintrin.h>
+
+namespace {
+    float horizontalSum(__m256 v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1,1,1,1)));
+        return _mm_cvtss_f32(s);
+    }
+}
+
+float squaredDistanceAvx2(const float* a, const float* b, int n) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+    }
+    for(; i + 8 <= n; i += 8) {
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum0 = _mm256_fmadd_ps(d, d, sum0);
+    }
+    float sum = horizontalSum(_mm256_add_ps(sum0, sum1));
+    for(; i < n; ++i) {
+        const float d = a[i] - b[i];
+        sum += d*d;
+    }
+    return sum;
+}
+
+//8 codes per step, widened with one vpmovsxbd
+float squaredDistanceQuantizedAvx2(const float* a, const signed char* codes, const float* scale, int n) {
+    __m256 sum = _mm256_setzero_ps();
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(codes + i));
+        const __m256 values = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes)), _mm256_loadu_ps(scale + i));
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), values);
+        sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    float total = horizontalSum(sum);
+    for(; i < n; ++i) {
+        const float d = a[i] - codes[i]*scale[i];
+        total += d*d;
+    }
+    return total;
+}
+
+//Four basis rows per pass over x, the loads of x are shared by the four fmas
+void dotProductsAvx2(const float* x, const float* rows, size_t step, int count, int n, float* out) {
+    for(int r = 0; r < count; r += 4) {
+        const int block = count - r < 4 ? count - r : 4;
+        const float* row[4];
+        for(int b = 0; b < 4; ++b) {
+            //A short last block repeats its last row, the extra results are dropped
+            row[b] = rows + (r + (b < block ? b : block - 1)) * step;
+        }
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            const __m256 v = _mm256_loadu_ps(x + i);
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(row[0] + i), v, s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(row[1] + i), v, s1);
+            s2 = _mm256_fmadd_ps(_mm256_loadu_ps(row[2] + i), v, s2);
+            s3 = _mm256_fmadd_ps(_mm256_loadu_ps(row[3] + i), v, s3);
+        }
+        float sums[4] = { horizontalSum(s0), horizontalSum(s1), horizontalSum(s2), horizontalSum(s3) };
+        for(; i < n; ++i) {
+            for(int b = 0; b < 4; ++b) {
+                sums[b] += row[b][i] * x[i];
+            }
+        }
+        for(int b = 0; b < block; ++b) {
+            out[r + b] = sums[b];
+        }
+    }
+}
+#endif
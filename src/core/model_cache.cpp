@@ -0,0 +1,202 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <object_recognition/model_cache.h>
+
+namespace {
+    const char magic[8] = { 'O', 'R', 'M', 'O', 'D', 'E', 'L', 0 };
+    //Sections start on cache lines, so the float rows are aligned for the distance kernels
+    const boost::uint64_t alignment = 64;
+
+    //Native byte order, the file is a cache and not meant to move between machines
+    struct model_header {
+        char magic[8];
+        boost::uint32_t version;
+        boost::uint32_t headerSize;
+        boost::uint64_t hash;
+        boost::int32_t samples, inputs, components, names, classes, prototypeLength;
+        boost::uint64_t mean, eigenvalues, eigenvectors, features, labels, prototypes, nameTable, fileSize;
+    };
+
+    boost::uint64_t aligned(boost::uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    bool inside(boost::uint64_t offset, boost::uint64_t bytes, boost::uint64_t size) {
+        return offset <= size && bytes <= size - offset;
+    }
+
+    cv::Mat floatMat(const char* base, boost::uint64_t offset, int rows, int cols) {
+        return cv::Mat(rows, cols, CV_32FC1, const_cast<char*>(base + offset));
+    }
+
+    void writeMat(std::ofstream& out, const cv::Mat& m, boost::uint64_t offset) {
+        out.seekp(offset);
+        cv::Mat f;
+        m.convertTo(f, CV_32F);
+        for(int i = 0; i < f.rows; ++i) {
+            out.write(f.ptr<char>(i), f.cols * sizeof(float));
+        }
+    }
+}
+
+const boost::uint32_t model_file::version;
+
+bool content_hash::addFile(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in) {
+        return false;
+    }
+    char buffer[1 << 16];
+    while(in) {
+        in.read(buffer, sizeof(buffer));
+        add(buffer, in.gcount());
+    }
+    return true;
+}
+
+bool model_file::open(const std::string& path, boost::uint64_t hash, trained_model& model) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(model_header))) {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        return false;
+    }
+    data_ = data;
+    size_ = st.st_size;
+
+    const char* base = static_cast<const char*>(data_);
+    model_header h;
+    memcpy(&h, base, sizeof(h));
+    if(memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version || h.headerSize != sizeof(model_header) ||
+       h.hash != hash || h.fileSize != size_) {
+        close();
+        return false;
+    }
+    const boost::uint64_t floatBytes = sizeof(float);
+    if(h.samples < 0 || h.inputs < 0 || h.components < 0 || h.names < 0 || h.classes < 0 || h.prototypeLength < 0 ||
+       !inside(h.mean, floatBytes * h.inputs, size_) ||
+       !inside(h.eigenvalues, floatBytes * h.components, size_) ||
+       !inside(h.eigenvectors, floatBytes * h.components * h.inputs, size_) ||
+       !inside(h.features, floatBytes * h.samples * h.components, size_) ||
+       !inside(h.labels, sizeof(boost::int32_t) * h.samples, size_) ||
+       !inside(h.prototypes, floatBytes * h.classes * h.prototypeLength, size_) ||
+       !inside(h.nameTable, 0, size_)) {
+        close();
+        return false;
+    }
+
+    model.mean = floatMat(base, h.mean, 1, h.inputs);
+    model.eigenvalues = floatMat(base, h.eigenvalues, h.components, 1);
+    model.eigenvectors = floatMat(base, h.eigenvectors, h.components, h.inputs);
+    model.features = floatMat(base, h.features, h.samples, h.components);
+    model.prototypes = floatMat(base, h.prototypes, h.classes, h.prototypeLength);
+    const boost::int32_t* labels = reinterpret_cast<const boost::int32_t*>(base + h.labels);
+    model.labels.assign(labels, labels + h.samples);
+    //label, length and the characters of every name
+    model.names.clear();
+    boost::uint64_t offset = h.nameTable;
+    for(int i = 0; i < h.names; ++i) {
+        boost::int32_t entry[2];
+        if(!inside(offset, sizeof(entry), size_)) {
+            close();
+            return false;
+        }
+        memcpy(entry, base + offset, sizeof(entry));
+        offset += sizeof(entry);
+        if(entry[1] < 0 || !inside(offset, entry[1], size_)) {
+            close();
+            return false;
+        }
+        model.names[entry[0]] = std::string(base + offset, entry[1]);
+        offset += entry[1];
+    }
+    return true;
+}
+
+void model_file::close() {
+    if(data_) {
+        munmap(data_, size_);
+        data_ = NULL;
+        size_ = 0;
+    }
+}
+
+bool model_file::save(const std::string& path, boost::uint64_t hash, const trained_model& model) {
+    model_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.headerSize = sizeof(model_header);
+    h.hash = hash;
+    h.samples = model.features.rows;
+    h.inputs = model.mean.total();
+    h.components = model.eigenvectors.rows;
+    h.names = model.names.size();
+    h.classes = model.prototypes.rows;
+    h.prototypeLength = model.prototypes.cols;
+    if(model.features.cols != h.components || model.eigenvectors.cols != h.inputs ||
+       int(model.labels.size()) != h.samples) {
+        return false;
+    }
+    const boost::uint64_t floatBytes = sizeof(float);
+    h.mean = aligned(sizeof(model_header));
+    h.eigenvalues = aligned(h.mean + floatBytes * h.inputs);
+    h.eigenvectors = aligned(h.eigenvalues + floatBytes * h.components);
+    h.features = aligned(h.eigenvectors + floatBytes * h.components * h.inputs);
+    h.labels = aligned(h.features + floatBytes * h.samples * h.components);
+    h.prototypes = aligned(h.labels + sizeof(boost::int32_t) * h.samples);
+    h.nameTable = h.prototypes + floatBytes * h.classes * h.prototypeLength;
+    h.fileSize = h.nameTable;
+    for(std::map<int, std::string>::const_iterator i = model.names.begin(); i != model.names.end(); ++i) {
+        h.fileSize += 2 * sizeof(boost::int32_t) + i->second.size();
+    }
+
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+        if(!out) {
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        writeMat(out, model.mean.reshape(1, 1), h.mean);
+        writeMat(out, model.eigenvalues.reshape(1, 1), h.eigenvalues);
+        writeMat(out, model.eigenvectors, h.eigenvectors);
+        writeMat(out, model.features, h.features);
+        out.seekp(h.labels);
+        for(size_t i = 0; i < model.labels.size(); ++i) {
+            const boost::int32_t label = model.labels[i];
+            out.write(reinterpret_cast<const char*>(&label), sizeof(label));
+        }
+        writeMat(out, model.prototypes, h.prototypes);
+        out.seekp(h.nameTable);
+        for(std::map<int, std::string>::const_iterator i = model.names.begin(); i != model.names.end(); ++i) {
+            const boost::int32_t entry[2] = { i->first, boost::int32_t(i->second.size()) };
+            out.write(reinterpret_cast<const char*>(entry), sizeof(entry));
+            out.write(i->second.data(), i->second.size());
+        }
+        if(!out) {
+            out.close();
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+    if(rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
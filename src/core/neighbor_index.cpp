@@ -0,0 +1,447 @@
+#include <cmath>
+#include <queue>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <object_recognition/neighbor_index.h>
+
+namespace {
+    typedef std::pair<float, int> scored;
+
+    //Keeps the k best of everything offered in a max heap on the distance
+    class best_k {
+    public:
+        explicit best_k(int k) : k_(k) {}
+
+        void offer(float distance, int index) {
+            if(int(heap_.size()) < k_) {
+                heap_.push(scored(distance, index));
+            } else if(distance < heap_.top().first) {
+                heap_.pop();
+                heap_.push(scored(distance, index));
+            }
+        }
+
+        bool full() const { return int(heap_.size()) >= k_; }
+        float worst() const { return heap_.empty() ? std::numeric_limits<float>::max() : heap_.top().first; }
+
+        //Empties the heap into the outputs, nearest first
+        void extract(std::vector<int>& indices, std::vector<float>& distances) {
+            indices.resize(heap_.size());
+            distances.resize(heap_.size());
+            for(int i = int(heap_.size()) - 1; i >= 0; --i) {
+                distances[i] = heap_.top().first;
+                indices[i] = heap_.top().second;
+                heap_.pop();
+            }
+        }
+
+    private:
+        int k_;
+        std::priority_queue<scored> heap_;
+    };
+
+    //Compares every sample, the reference for the others
+    class brute_force_index : public neighbor_index {
+    public:
+        explicit brute_force_index(bool quantized) : neighbor_index(quantized) {}
+
+        void build(const cv::Mat& features) {
+            setFeatures(features);
+            finishBuild();
+        }
+
+        void search(const float* query, int k, std::vector<int>& indices, std::vector<float>& distances,
+                    neighbor_search_context&) const {
+            best_k best(k);
+            for(int i = 0; i < size(); ++i) {
+                best.offer(distance(query, i), i);
+            }
+            best.extract(indices, distances);
+        }
+
+        //Goes through the samples in blocks that stay in the cache while every
+        //query is compared with them, so the samples are read once per batch
+        void searchBatch(const cv::Mat& queries, int k, std::vector<std::vector<int> >& indices,
+                         std::vector<std::vector<float> >& distances, neighbor_search_context&) const {
+            std::vector<best_k> best(queries.rows, best_k(k));
+            const int block = std::max(1, (256 * 1024) / std::max(1, dims() * int(quantized() ? 1 : sizeof(float))));
+            for(int begin = 0; begin < size(); begin += block) {
+                const int end = std::min(size(), begin + block);
+                for(int q = 0; q < queries.rows; ++q) {
+                    const float* query = queries.ptr<float>(q);
+                    for(int i = begin; i < end; ++i) {
+                        best[q].offer(distance(query, i), i);
+                    }
+                }
+            }
+            indices.resize(queries.rows);
+            distances.resize(queries.rows);
+            for(int q = 0; q < queries.rows; ++q) {
+                best[q].extract(indices[q], distances[q]);
+            }
+        }
+    };
+
+    //Vantage point tree, exact. Every node splits its samples at the median
+    //distance to its vantage point; a subtree is skipped when the triangle
+    //inequality shows it can not hold anything closer than the current k-th
+    //neighbor. Small subtrees are scanned linearly.
+    class vp_tree_index : public neighbor_index {
+    public:
+        explicit vp_tree_index(bool quantized) : neighbor_index(quantized), root_(-1) {}
+
+        void build(const cv::Mat& features) {
+            setFeatures(features);
+            nodes_.clear();
+            order_.resize(size());
+            for(int i = 0; i < size(); ++i) {
+                order_[i] = i;
+            }
+            root_ = buildNode(0, size());
+            finishBuild();
+        }
+
+        void search(const float* query, int k, std::vector<int>& indices, std::vector<float>& distances,
+                    neighbor_search_context&) const {
+            best_k best(k);
+            if(root_ >= 0) {
+                searchNode(root_, query, best);
+            }
+            best.extract(indices, distances);
+        }
+
+    private:
+        static const int leafSize = 8;
+
+        //Samples order_[begin, end), the vantage point is order_[begin].
+        //inside holds the samples closer than radius, outside the others.
+        struct node {
+            int begin, end;
+            float radius;
+            int inside, outside;
+        };
+
+        int buildNode(int begin, int end) {
+            if(begin >= end) {
+                return -1;
+            }
+            const int index = nodes_.size();
+            nodes_.push_back(node());
+            node n;
+            n.begin = begin;
+            n.end = end;
+            n.radius = 0;
+            n.inside = n.outside = -1;
+            if(end - begin > leafSize) {
+                //Sort the others by their distance to the vantage point and split at the median
+                const float* vp = sample(order_[begin]);
+                std::vector<std::pair<float, int> > byDistance(end - begin - 1);
+                for(int i = begin + 1; i < end; ++i) {
+                    byDistance[i - begin - 1] = std::make_pair(std::sqrt(distance(vp, order_[i])), order_[i]);
+                }
+                const int median = byDistance.size() / 2;
+                std::nth_element(byDistance.begin(), byDistance.begin() + median, byDistance.end());
+                n.radius = byDistance[median].first;
+                for(size_t i = 0; i < byDistance.size(); ++i) {
+                    order_[begin + 1 + i] = byDistance[i].second;
+                }
+                n.inside = buildNode(begin + 1, begin + 1 + median);
+                n.outside = buildNode(begin + 1 + median, end);
+            }
+            nodes_[index] = n;
+            return index;
+        }
+
+        void searchNode(int index, const float* query, best_k& best) const {
+            const node& n = nodes_[index];
+            if(n.inside < 0 && n.outside < 0) {
+                for(int i = n.begin; i < n.end; ++i) {
+                    best.offer(distance(query, order_[i]), order_[i]);
+                }
+                return;
+            }
+            const float squared = distance(query, order_[n.begin]);
+            best.offer(squared, order_[n.begin]);
+            const float d = std::sqrt(squared);
+            //The bound shrinks while searching, so it is read again before the second subtree
+            if(d < n.radius) {
+                if(n.inside >= 0) searchNode(n.inside, query, best);
+                if(n.outside >= 0 && (!best.full() || d + std::sqrt(best.worst()) >= n.radius)) searchNode(n.outside, query, best);
+            } else {
+                if(n.outside >= 0) searchNode(n.outside, query, best);
+                if(n.inside >= 0 && (!best.full() || d - std::sqrt(best.worst()) <= n.radius)) searchNode(n.inside, query, best);
+            }
+        }
+
+        std::vector<node> nodes_;
+        std::vector<int> order_;
+        int root_;
+    };
+
+    //Hierarchical navigable small world graph, approximate.
+    //Every sample is linked to its nearest samples on level 0 and, with
+    //exponentially falling probability, on the levels above. A search walks
+    //greedily down from the top level and then explores level 0 with a
+    //candidate list of efSearch entries.
+    class hnsw_index : public neighbor_index {
+    public:
+        hnsw_index(bool quantized, int M, int efConstruction, int efSearch) :
+            neighbor_index(quantized),
+            M_(std::max(2, M)),
+            efConstruction_(std::max(M_, efConstruction)),
+            efSearch_(efSearch),
+            entry_(-1),
+            maxLevel_(-1),
+            visitTag_(0)
+        {
+        }
+
+        void build(const cv::Mat& features) {
+            setFeatures(features);
+            links_.assign(size(), std::vector<std::vector<int> >());
+            entry_ = -1;
+            maxLevel_ = -1;
+            visited_.assign(size(), 0);
+            visitTag_ = 0;
+            //Fixed seed, the same training set always gives the same graph
+            cv::RNG rng(0x5eed);
+            const double levelFactor = 1.0 / std::log(double(M_));
+            for(int i = 0; i < size(); ++i) {
+                const double u = std::max(1e-12, double(rng.uniform(0.f, 1.f)));
+                insert(i, int(-std::log(u) * levelFactor));
+            }
+            std::vector<unsigned>().swap(visited_);
+            finishBuild();
+        }
+
+        void search(const float* query, int k, std::vector<int>& indices, std::vector<float>& distances,
+                    neighbor_search_context& context) const {
+            if(entry_ < 0) {
+                indices.clear();
+                distances.clear();
+                return;
+            }
+            int current = entry_;
+            float currentDistance = distance(query, current);
+            for(int level = maxLevel_; level > 0; --level) {
+                greedy(query, level, current, currentDistance);
+            }
+            //The buffer is only cleared when the tag wraps around
+            if(int(context.visited.size()) != size() || ++context.tag == 0) {
+                context.visited.assign(size(), 0);
+                context.tag = 1;
+            }
+            std::vector<scored> found;
+            searchLevel(query, current, currentDistance, std::max(efSearch_, k), 0, found, context.visited, context.tag);
+            const int count = std::min<int>(k, found.size());
+            indices.resize(count);
+            distances.resize(count);
+            for(int i = 0; i < count; ++i) {
+                distances[i] = found[i].first;
+                indices[i] = found[i].second;
+            }
+        }
+
+    private:
+        void insert(int id, int level) {
+            links_[id].resize(level + 1);
+            if(entry_ < 0) {
+                entry_ = id;
+                maxLevel_ = level;
+                return;
+            }
+            const float* q = sample(id);
+            int current = entry_;
+            float currentDistance = distance(q, current);
+            for(int l = maxLevel_; l > level; --l) {
+                greedy(q, l, current, currentDistance);
+            }
+            for(int l = std::min(level, maxLevel_); l >= 0; --l) {
+                std::vector<scored> found;
+                searchLevel(q, current, currentDistance, efConstruction_, l, found, visited_, ++visitTag_);
+                const int maxLinks = l == 0 ? 2*M_ : M_;
+                const int count = std::min<int>(M_, found.size());
+                for(int i = 0; i < count; ++i) {
+                    const int other = found[i].second;
+                    links_[id][l].push_back(other);
+                    links_[other][l].push_back(id);
+                    if(int(links_[other][l].size()) > maxLinks) {
+                        shrink(other, l, maxLinks);
+                    }
+                }
+                current = found[0].second;
+                currentDistance = found[0].first;
+            }
+            if(level > maxLevel_) {
+                entry_ = id;
+                maxLevel_ = level;
+            }
+        }
+
+        //Keeps the closest links of a node
+        void shrink(int id, int level, int maxLinks) {
+            std::vector<int>& links = links_[id][level];
+            std::vector<scored> byDistance(links.size());
+            for(size_t i = 0; i < links.size(); ++i) {
+                byDistance[i] = scored(distance(sample(id), links[i]), links[i]);
+            }
+            std::partial_sort(byDistance.begin(), byDistance.begin() + maxLinks, byDistance.end());
+            links.resize(maxLinks);
+            for(int i = 0; i < maxLinks; ++i) {
+                links[i] = byDistance[i].second;
+            }
+        }
+
+        //Moves to a closer neighbor as long as there is one
+        void greedy(const float* query, int level, int& current, float& currentDistance) const {
+            bool moved = true;
+            while(moved) {
+                moved = false;
+                const std::vector<int>& links = links_[current][level];
+                for(size_t i = 0; i < links.size(); ++i) {
+                    const float d = distance(query, links[i]);
+                    if(d < currentDistance) {
+                        currentDistance = d;
+                        current = links[i];
+                        moved = true;
+                    }
+                }
+            }
+        }
+
+        //Best first search of one level, found holds the ef closest samples, nearest first.
+        //Samples with visited[i] == tag were seen already, so the buffer is only cleared
+        //once while building and once per search context.
+        void searchLevel(const float* query, int start, float startDistance, int ef, int level, std::vector<scored>& found,
+                         std::vector<unsigned>& visited, unsigned tag) const {
+            //Min heap of samples to expand and max heap of the results
+            std::priority_queue<scored, std::vector<scored>, std::greater<scored> > candidates;
+            std::priority_queue<scored> results;
+            candidates.push(scored(startDistance, start));
+            results.push(scored(startDistance, start));
+            visited[start] = tag;
+            while(!candidates.empty()) {
+                const scored c = candidates.top();
+                if(c.first > results.top().first && int(results.size()) >= ef) {
+                    break;
+                }
+                candidates.pop();
+                if(level >= int(links_[c.second].size())) {
+                    continue;
+                }
+                const std::vector<int>& links = links_[c.second][level];
+                for(size_t i = 0; i < links.size(); ++i) {
+                    const int next = links[i];
+                    if(visited[next] == tag) {
+                        continue;
+                    }
+                    visited[next] = tag;
+                    const float d = distance(query, next);
+                    if(int(results.size()) < ef || d < results.top().first) {
+                        candidates.push(scored(d, next));
+                        results.push(scored(d, next));
+                        if(int(results.size()) > ef) {
+                            results.pop();
+                        }
+                    }
+                }
+            }
+            found.resize(results.size());
+            for(int i = int(results.size()) - 1; i >= 0; --i) {
+                found[i] = results.top();
+                results.pop();
+            }
+        }
+
+        int M_, efConstruction_, efSearch_;
+        int entry_, maxLevel_;
+        std::vector<unsigned> visited_;
+        unsigned visitTag_;
+        //links_[sample][level] are the neighbors of a sample on that level
+        std::vector<std::vector<std::vector<int> > > links_;
+    };
+}
+
+neighbor_index* neighbor_index::create(const neighbor_index_params& params) {
+    if(params.type == "bruteforce") {
+        return new brute_force_index(params.quantized);
+    }
+    if(params.type == "vptree") {
+        return new vp_tree_index(params.quantized);
+    }
+    if(params.type == "hnsw") {
+        return new hnsw_index(params.quantized, params.hnswM, params.hnswEfConstruction, params.hnswEfSearch);
+    }
+    return NULL;
+}
+
+void neighbor_index::searchBatch(const cv::Mat& queries, int k, std::vector<std::vector<int> >& indices,
+                                 std::vector<std::vector<float> >& distances, neighbor_search_context& context) const {
+    indices.resize(queries.rows);
+    distances.resize(queries.rows);
+    for(int q = 0; q < queries.rows; ++q) {
+        search(queries.ptr<float>(q), k, indices[q], distances[q], context);
+    }
+}
+
+//Symmetric quantization per dimension: the largest magnitude of a dimension
+//maps to 127. The PCA projections are centered, so no offset is needed.
+//A quantized index is built on the dequantized rows, so the radii and links of
+//its structure hold for the distances its searches compute.
+void neighbor_index::setFeatures(const cv::Mat& features) {
+    features_ = features.clone();
+    codes_.release();
+    scale_.clear();
+    size_ = features_.rows;
+    dims_ = features_.cols;
+    if(!quantized_ || size_ == 0) {
+        return;
+    }
+    scale_.assign(dims_, 0.f);
+    for(int i = 0; i < size_; ++i) {
+        const float* row = sample(i);
+        for(int j = 0; j < dims_; ++j) {
+            scale_[j] = std::max(scale_[j], std::fabs(row[j]));
+        }
+    }
+    for(int j = 0; j < dims_; ++j) {
+        scale_[j] = scale_[j] > 0 ? scale_[j] / 127.f : 1.f;
+    }
+    codes_.create(size_, dims_, CV_8SC1);
+    for(int i = 0; i < size_; ++i) {
+        float* row = features_.ptr<float>(i);
+        signed char* code = codes_.ptr<signed char>(i);
+        for(int j = 0; j < dims_; ++j) {
+            const int q = cvRound(row[j] / scale_[j]);
+            code[j] = static_cast<signed char>(std::max(-127, std::min(127, q)));
+            row[j] = code[j] * scale_[j];
+        }
+    }
+}
+
+void neighbor_index::finishBuild() {
+    if(quantized_ && size_ > 0) {
+        features_.release();
+    }
+}
+
+int voteNeighbors(const std::vector<int>& neighborLabels, int& votes) {
+    std::vector<int> sorted(neighborLabels);
+    std::sort(sorted.begin(), sorted.end());
+    int best = sorted.empty() ? -1 : sorted[0];
+    int bestCount = 0;
+    size_t runStart = 0;
+    for(size_t i = 1; i <= sorted.size(); ++i) {
+        if(i == sorted.size() || sorted[i] != sorted[i - 1]) {
+            if(int(i - runStart) > bestCount) {
+                bestCount = i - runStart;
+                best = sorted[i - 1];
+            }
+            runStart = i;
+        }
+    }
+    votes = bestCount;
+    return best;
+}
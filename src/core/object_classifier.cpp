@@ -0,0 +1,766 @@
+#include <iostream>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/types.h>
+#include <cmath>
+#include <boost/thread.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+#include <object_recognition/object_classifier.h>
+#include <object_recognition/stage_profiler.h>
+#include <object_recognition/atomic_value.h>
+
+object_classifier::object_classifier(const classifier_params& params) :
+    params_(params),
+    trained_(false)
+{
+}
+
+bool object_classifier::train(const std::string& imagedir) {
+    sample_pack pack;
+    const bool packed = pack.open(imagedir);
+    image_paths objects;
+    if(!packed) {
+        objects = readTestImagePaths(imagedir);
+    }
+    boost::uint64_t hash = 0;
+    if(!params_.modelFile.empty()) {
+        hash = modelHash(imagedir, objects);
+        boost::scoped_ptr<model_file> file(new model_file);
+        trained_model model;
+        if(file->open(params_.modelFile, hash, model) && useModel(model)) {
+            //The old mapping goes away with file, pca_ no longer points into it
+            modelFile_.swap(file);
+            std::cout << "Loaded the model from " << params_.modelFile << std::endl;
+            return true;
+        }
+    }
+
+    trained_model model;
+    cv::Mat samples, cascadeData;
+    bool loaded;
+    if(packed) {
+        for(size_t i = 0; i < pack.labelNames().size(); i++) {
+            std::cout << pack.labelNames()[i] << " = " << i << std::endl;
+            model.names[i] = pack.labelNames()[i];
+        }
+        loaded = loadPack(pack, model.labels, samples, cascadeData);
+    } else {
+        std::vector<std::string> paths;
+        for(size_t i = 0; i < objects.size(); i++) {
+            std::cout << objects[i].first << " = " << i << std::endl;
+            model.names[i] = objects[i].first;
+            std::vector<std::string>& vec = objects[i].second;
+            for(size_t j = 0; j < vec.size(); j++) {
+                paths.push_back(imagedir + objects[i].first + "/" + vec[j]);
+                model.labels.push_back(int(i));
+            }
+        }
+        loaded = loadImages(paths, model.labels, samples, cascadeData);
+    }
+    if(!loaded) {
+        std::cout << "No training images in " << imagedir << std::endl;
+        return false;
+    }
+    trainPCA(samples, model.features);
+    model.features.convertTo(model.features, CV_32F);
+    model.mean = pca_.mean;
+    model.eigenvalues = pca_.eigenvalues;
+    model.eigenvectors = pca_.eigenvectors;
+    model.prototypes = color_cascade(params_.cascade).prototypes(cascadeData, model.labels, int(model.names.size()));
+    if(!useModel(model)) {
+        return false;
+    }
+    modelFile_.reset();
+    if(!params_.modelFile.empty() && !model_file::save(params_.modelFile, hash, model)) {
+        std::cout << "Could not save the model to " << params_.modelFile << std::endl;
+    }
+    return true;
+}
+
+namespace {
+    //Takes the next image until all are taken, so slow decodes do not hold up a thread
+    struct row_loader {
+        row_loader(const object_classifier& classifier, const color_cascade& cascade, const std::vector<std::string>& paths,
+                   atomic_value<size_t>& next, cv::Mat& samples, cv::Mat& cascadeData, std::vector<char>& loaded) :
+            classifier(classifier), cascade(cascade), paths(paths), next(next), samples(samples),
+            cascadeData(cascadeData), loaded(loaded)
+        {
+        }
+
+        void operator()() const {
+            for(size_t i = next.fetch_add(1); i < paths.size(); i = next.fetch_add(1)) {
+                cv::Mat inputImg = cv::imread(paths[i]);
+                if(inputImg.empty()) {
+                    continue;
+                }
+                classifier.toSampleSize(inputImg);
+                classifier.matToByteRow(inputImg, samples.ptr<uchar>(i));
+                cascade.features(inputImg, cascadeData.ptr<float>(i));
+                loaded[i] = 1;
+            }
+        }
+
+        const object_classifier& classifier;
+        const color_cascade& cascade;
+        const std::vector<std::string>& paths;
+        atomic_value<size_t>& next;
+        cv::Mat& samples;
+        cv::Mat& cascadeData;
+        std::vector<char>& loaded;
+    };
+}
+
+bool object_classifier::loadImages(const std::vector<std::string>& paths, std::vector<int>& labels, cv::Mat& samples,
+                                   cv::Mat& cascadeData) const {
+    size_t first = 0;
+    cv::Mat firstImg;
+    while(first < paths.size() && (firstImg = cv::imread(paths[first])).empty()) {
+        ++first;
+    }
+    if(firstImg.empty()) {
+        return false;
+    }
+    toSampleSize(firstImg);
+    //With the parameters of this training, cascade_ changes with the model
+    const color_cascade cascade(params_.cascade);
+    samples.create(paths.size(), firstImg.total() * params_.attributes, CV_8UC1);
+    cascadeData.create(paths.size(), cascade.featureLength(), CV_32FC1);
+    std::vector<char> loaded(paths.size(), 0);
+    matToByteRow(firstImg, samples.ptr<uchar>(first));
+    cascade.features(firstImg, cascadeData.ptr<float>(first));
+    loaded[first] = 1;
+
+    atomic_value<size_t> next(first + 1);
+    const row_loader loader(*this, cascade, paths, next, samples, cascadeData, loaded);
+    int threads = params_.loaderThreads > 0 ? params_.loaderThreads : int(boost::thread::hardware_concurrency());
+    threads = std::max(1, std::min<int>(threads, paths.size() - first - 1));
+    boost::thread_group workers;
+    for(int i = 1; i < threads; ++i) {
+        workers.create_thread(loader);
+    }
+    loader();
+    workers.join_all();
+
+    //Moves the rows up over the images that could not be read
+    int rows = 0;
+    for(size_t i = 0; i < paths.size(); ++i) {
+        if(!loaded[i]) {
+            continue;
+        }
+        if(rows != int(i)) {
+            samples.row(i).copyTo(samples.row(rows));
+            cascadeData.row(i).copyTo(cascadeData.row(rows));
+            labels[rows] = labels[i];
+        }
+        ++rows;
+    }
+    if(rows < int(paths.size())) {
+        std::cout << "Skipped " << paths.size() - rows << " images that could not be read" << std::endl;
+    }
+    samples = samples.rowRange(0, rows);
+    cascadeData = cascadeData.rowRange(0, rows);
+    labels.resize(rows);
+    return true;
+}
+
+//The samples are read straight from the mapping, nothing is allocated per sample
+bool object_classifier::loadPack(const sample_pack& pack, std::vector<int>& labels, cv::Mat& samples,
+                                 cv::Mat& cascadeData) const {
+    if(pack.size() == 0) {
+        return false;
+    }
+    samples.create(pack.size(), params_.sampleWidth * params_.sampleHeight * params_.attributes, CV_8UC1);
+    const color_cascade cascade(params_.cascade);
+    cascadeData.create(pack.size(), cascade.featureLength(), CV_32FC1);
+    labels.resize(pack.size());
+    cv::Mat image;
+    for(int i = 0; i < pack.size(); i++) {
+        image = pack.image(i);
+        toSampleSize(image);
+        matToByteRow(image, samples.ptr<uchar>(i));
+        cascade.features(image, cascadeData.ptr<float>(i));
+        labels[i] = pack.label(i);
+    }
+    return true;
+}
+
+bool object_classifier::useModel(const trained_model& model) {
+    neighbor_index* index = neighbor_index::create(params_.index);
+    if(!index) {
+        std::cout << "Unknown neighbor index " << params_.index.type << std::endl;
+        return false;
+    }
+    index->build(model.features);
+    boost::unique_lock<boost::shared_mutex> lock(modelMutex_);
+    index_.reset(index);
+    features_ = model.features;
+    addedRows_.release();
+    addedFeatures_.release();
+    pca_.mean = model.mean;
+    pca_.eigenvalues = model.eigenvalues;
+    pca_.eigenvectors = model.eigenvectors;
+    //project() works on floats, a pca.yml may hold doubles
+    if(pca_.mean.type() != CV_32F) {
+        pca_.mean.convertTo(pca_.mean, CV_32F);
+    }
+    if(pca_.eigenvectors.type() != CV_32F) {
+        pca_.eigenvectors.convertTo(pca_.eigenvectors, CV_32F);
+    }
+    sampleLabels_ = model.labels;
+    intToDesc_ = model.names;
+    //Without prototypes, like from a pca.yml, the cascade never answers
+    cascade_.configure(params_.cascade);
+    if(model.prototypes.cols == cascade_.featureLength()) {
+        cascade_.setPrototypes(model.prototypes, model.labels);
+    }
+    trained_ = true;
+    return true;
+}
+
+//Covers the contents of every image, not only the names, so replacing an image
+//invalidates the cache too. Reading the files is far cheaper than decoding them.
+//Sorted, the order readdir() returns them in does not matter. A sample pack has
+//no objects and is hashed as a whole.
+boost::uint64_t object_classifier::modelHash(const std::string& imagedir, const image_paths& objects) const {
+    content_hash hash;
+    hash.addValue(model_file::version);
+    hash.addValue(params_.attributes);
+    hash.addValue(params_.sampleWidth);
+    hash.addValue(params_.sampleHeight);
+    hash.addValue(params_.pcaAccuracy);
+    hash.add(params_.pcaTrainer);
+    hash.addValue(params_.pcaTraining.blockSize);
+    hash.addValue(params_.pcaTraining.initialComponents);
+    hash.addValue(params_.pcaTraining.oversampling);
+    hash.addValue(params_.pcaTraining.powerIterations);
+    hash.addValue(params_.pcaTraining.seed);
+    hash.addValue(params_.cascade.hueBins);
+    hash.addValue(params_.cascade.saturationBins);
+    hash.addValue(params_.cascade.minSaturation);
+    const bool pcaFromFile = params_.loadPca && !params_.pcaFile.empty();
+    hash.addValue(pcaFromFile && hash.addFile(params_.pcaFile));
+    if(objects.empty()) {
+        hash.addFile(imagedir);
+    }
+    image_paths sorted(objects);
+    std::sort(sorted.begin(), sorted.end());
+    for(size_t i = 0; i < sorted.size(); i++) {
+        std::vector<std::string>& vec = sorted[i].second;
+        std::sort(vec.begin(), vec.end());
+        hash.add(sorted[i].first);
+        for(size_t j = 0; j < vec.size(); j++) {
+            hash.add(vec[j]);
+            hash.addFile(imagedir + sorted[i].first + "/" + vec[j]);
+        }
+    }
+    return hash.value();
+}
+
+namespace {
+    //Projects the 8 bit samples a block of rows at a time, so they are never all floats at once
+    void projectSamples(const cv::PCA& pca, const cv::Mat& samples, cv::Mat& result) {
+        const int block = 256;
+        cv::Mat rows, projected;
+        for(int r = 0; r < samples.rows; r += block) {
+            const int count = std::min(block, samples.rows - r);
+            samples.rowRange(r, r + count).convertTo(rows, CV_32F);
+            pca.project(rows, projected);
+            if(result.empty()) {
+                result.create(samples.rows, projected.cols, projected.type());
+            }
+            cv::Mat target = result.rowRange(r, r + count);
+            projected.copyTo(target);
+        }
+    }
+}
+
+void object_classifier::trainPCA(const cv::Mat& samples, cv::Mat& result) {
+    result.release();
+    if(params_.loadPca && !params_.pcaFile.empty()) {
+        cv::FileStorage fs1(params_.pcaFile, cv::FileStorage::READ);
+        if(fs1.isOpened()) {
+            cv::Mat loadeigenvectors, loadeigenvalues, loadedmean;
+            fs1["Eigenvalues"] >> loadeigenvalues;
+            fs1["Eigenvector"] >> loadeigenvectors;
+            fs1["Mean"] >> loadedmean;
+            fs1.release();
+            pca_.mean = loadedmean.clone();
+            pca_.eigenvalues = loadeigenvalues.clone();
+            pca_.eigenvectors = loadeigenvectors.clone();
+            projectSamples(pca_, samples, result);
+            std::cout << "Loaded succesfull! Cols left : " << result.cols << std::endl;
+            return;
+        }
+        std::cout << "Could not load " << params_.pcaFile << ", computing the PCA" << std::endl;
+    }
+
+    std::cout << " Rows before PCA " << samples.cols << std::endl;
+    if(params_.pcaTrainer == "truncated") {
+        pca_trainer(params_.pcaTraining).train(samples, params_.pcaAccuracy, pca_, result);
+    } else {
+        if(params_.pcaTrainer != "full") {
+            std::cout << "Unknown PCA trainer " << params_.pcaTrainer << ", using full" << std::endl;
+        }
+        cv::Mat rowImg;
+        samples.convertTo(rowImg, CV_32F);
+        pca_ = cv::PCA(rowImg, cv::Mat(), CV_PCA_DATA_AS_ROW, params_.pcaAccuracy);
+        pca_.project(rowImg, result);
+    }
+    std::cout << " Rows after PCA " << result.cols << std::endl;
+
+    if(params_.savePca && !params_.pcaFile.empty()) {
+        cv::FileStorage fs(params_.pcaFile, cv::FileStorage::WRITE);
+        fs << "Eigenvalues" << pca_.eigenvalues;
+        fs << "Eigenvector" << pca_.eigenvectors;
+        fs << "Mean" << pca_.mean;
+        fs.release();
+    }
+}
+
+void object_classifier::preprocess(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row,
+                                   classification_context& context) const {
+    cv::cvtColor(bgrImage, context.blurredImage, CV_BGR2HSV);
+    cv::medianBlur(context.blurredImage, context.blurredImage, params_.blurSize);
+    cv::resize(context.blurredImage, hsvSample, cv::Size(params_.sampleWidth, params_.sampleHeight), 0, 0, cv::INTER_AREA);
+    row = matToFloatRow(hsvSample);
+}
+
+void object_classifier::preprocessFused(const cv::Mat& bgrImage, cv::Mat& hsvSample, cv::Mat& row,
+                                        classification_context& context) const {
+    const cv::Size sampleSize(params_.sampleWidth, params_.sampleHeight);
+    cv::resize(bgrImage, context.small, sampleSize, 0, 0, cv::INTER_AREA);
+    cv::cvtColor(context.small, context.smallHsv, CV_BGR2HSV);
+    //The median over blurSize pixels of the crop covers blurSize * scale pixels of the sample
+    const double scale = std::min(double(sampleSize.width) / bgrImage.cols, double(sampleSize.height) / bgrImage.rows);
+    const int kernel = 2 * int(params_.blurSize * scale / 2) + 1;
+    if(kernel > 1) {
+        cv::medianBlur(context.smallHsv, hsvSample, kernel);
+    } else {
+        context.smallHsv.copyTo(hsvSample);
+    }
+    row.create(1, int(hsvSample.total()) * params_.attributes, CV_32FC1);
+    matToFloatRow(hsvSample, row.ptr<float>(0));
+}
+
+void object_classifier::project(const cv::Mat& row, cv::Mat& projected, classification_context& context) const {
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    projectRow(row, projected, context);
+}
+
+void object_classifier::projectRow(const cv::Mat& row, cv::Mat& projected, classification_context& context) const {
+    const int n = pca_.mean.cols;
+    context.centered.create(1, n, CV_32FC1);
+    const float* x = row.ptr<float>(0);
+    const float* mean = pca_.mean.ptr<float>(0);
+    float* centered = context.centered.ptr<float>(0);
+    for(int i = 0; i < n; i++) {
+        centered[i] = x[i] - mean[i];
+    }
+    projected.create(1, pca_.eigenvectors.rows, CV_32FC1);
+    dotProducts(centered, pca_.eigenvectors.ptr<float>(0), pca_.eigenvectors.step1(), pca_.eigenvectors.rows, n,
+                projected.ptr<float>(0));
+}
+
+void object_classifier::classify(const cv::Mat& bgrImage, const std::string& color, classification_result& result,
+                                 classification_context& context) const {
+    double preprocessMs = 0;
+    {
+        scoped_timer timer(preprocessMs, context.timing);
+        if(params_.fusedPreprocess) {
+            preprocessFused(bgrImage, context.blurredImage, context.row, context);
+        } else {
+            preprocess(bgrImage, context.sample, context.row, context);
+        }
+    }
+    double cascadeMs = 0;
+    bool answered = false;
+    if(params_.cascade.enabled) {
+        scoped_timer timer(cascadeMs, context.timing);
+        answered = classifyCascade(params_.fusedPreprocess ? context.blurredImage : context.sample, color, result, context);
+    }
+    if(answered) {
+        context.timings.clear();
+    } else {
+        classifyRow(context.row, result, context);
+        result.colorConsistent = result.name.find(color) != std::string::npos;
+    }
+    context.timings.preprocess = preprocessMs;
+    context.timings.cascade = cascadeMs;
+    context.timings.total += preprocessMs + cascadeMs;
+}
+
+bool object_classifier::classifyCascade(const cv::Mat& hsvSample, const std::string& color, classification_result& result,
+                                        classification_context& context) const {
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    const int classes = cascade_.prototypes().rows;
+    if(classes == 0) {
+        return false;
+    }
+    context.cascadeFeature.resize(cascade_.featureLength());
+    cascade_.features(hsvSample, &context.cascadeFeature[0]);
+    //The same test the node did on the KNN answer, but on the classes beforehand
+    context.allowedLabels.clear();
+    if(!color.empty()) {
+        context.allowedLabels.assign(classes, 0);
+        for(std::map<int, std::string>::const_iterator i = intToDesc_.begin(); i != intToDesc_.end(); ++i) {
+            if(i->first >= 0 && i->first < classes) {
+                context.allowedLabels[i->first] = i->second.find(color) != std::string::npos;
+            }
+        }
+    }
+    float distance, confidence;
+    const int label = cascade_.match(&context.cascadeFeature[0], context.allowedLabels, distance, confidence);
+    if(label < 0) {
+        return false;
+    }
+    std::map<int, std::string>::const_iterator name = intToDesc_.find(label);
+    result.label = label;
+    result.name = name != intToDesc_.end() ? name->second : std::string();
+    result.votes = 0;
+    result.neighborLabels.clear();
+    result.neighborDistances.clear();
+    result.cascade = true;
+    result.cascadeConfidence = confidence;
+    result.colorConsistent = true;
+    return true;
+}
+
+//Only reads the trained model and the index, everything written is in context
+void object_classifier::classifyRow(const cv::Mat& row, classification_result& result,
+                                    classification_context& context) const {
+    classification_timings& timings = context.timings;
+    timings.clear();
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    if(!index_ || row.type() != CV_32FC1 || row.cols != pca_.mean.cols) {
+        result = classification_result();
+        return;
+    }
+    {
+        scoped_timer timer(timings.projection, context.timing);
+        projectRow(row, context.projected, context);
+    }
+    {
+        scoped_timer timer(timings.knn, context.timing);
+        const float* query = context.projected.ptr<float>(0);
+        index_->search(query, params_.neighborCount, context.neighbors, result.neighborDistances, context.search);
+        searchAdded(query, params_.neighborCount, context.neighbors, result.neighborDistances);
+    }
+    timings.total = timings.projection + timings.knn;
+    vote(context.neighbors, result);
+}
+
+void object_classifier::classifyBatch(const std::vector<cv::Mat>& bgrImages, std::vector<classification_result>& results) {
+    double preprocessMs = 0;
+    {
+        scoped_timer timer(preprocessMs, context_.timing);
+        const int n = params_.sampleWidth * params_.sampleHeight * params_.attributes;
+        batchRows_.create(bgrImages.size(), n, CV_32FC1);
+        for(size_t i = 0; i < bgrImages.size(); i++) {
+            if(params_.fusedPreprocess) {
+                preprocessFused(bgrImages[i], context_.blurredImage, context_.row, context_);
+            } else {
+                preprocess(bgrImages[i], context_.sample, context_.row, context_);
+            }
+            context_.row.copyTo(batchRows_.row(i));
+        }
+    }
+    classifyRows(batchRows_, results);
+    context_.timings.preprocess = preprocessMs;
+    context_.timings.total += preprocessMs;
+}
+
+void object_classifier::classifyRows(const cv::Mat& rows, std::vector<classification_result>& results) {
+    classification_timings& timings = context_.timings;
+    timings.clear();
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    if(!index_ || rows.empty() || rows.type() != CV_32FC1 || rows.cols != pca_.mean.cols) {
+        results.assign(rows.rows, classification_result());
+        return;
+    }
+    {
+        scoped_timer timer(timings.projection, context_.timing);
+        const int n = pca_.mean.cols;
+        const float* mean = pca_.mean.ptr<float>(0);
+        batchCentered_.create(rows.rows, n, CV_32FC1);
+        for(int r = 0; r < rows.rows; r++) {
+            const float* x = rows.ptr<float>(r);
+            float* centered = batchCentered_.ptr<float>(r);
+            for(int i = 0; i < n; i++) {
+                centered[i] = x[i] - mean[i];
+            }
+        }
+        //All crops at once, the basis is read once per batch instead of once per crop
+        cv::gemm(batchCentered_, pca_.eigenvectors, 1, cv::Mat(), 0, batchProjected_, cv::GEMM_2_T);
+    }
+    {
+        scoped_timer timer(timings.knn, context_.timing);
+        index_->searchBatch(batchProjected_, params_.neighborCount, batchNeighbors_, batchDistances_, context_.search);
+        for(int r = 0; r < rows.rows; r++) {
+            searchAdded(batchProjected_.ptr<float>(r), params_.neighborCount, batchNeighbors_[r], batchDistances_[r]);
+        }
+    }
+    timings.total = timings.projection + timings.knn;
+
+    results.resize(rows.rows);
+    for(int r = 0; r < rows.rows; r++) {
+        results[r].neighborDistances.swap(batchDistances_[r]);
+        vote(batchNeighbors_[r], results[r]);
+    }
+}
+
+void object_classifier::leaveOneOut(std::vector<int>& expected, std::vector<classification_result>& results) const {
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    expected.clear();
+    results.clear();
+    if(!index_) {
+        return;
+    }
+    const int k = params_.neighborCount;
+    std::vector<int> neighbors;
+    neighbor_search_context context;
+    results.resize(features_.rows);
+    for(int i = 0; i < features_.rows; i++) {
+        classification_result& result = results[i];
+        const float* query = features_.ptr<float>(i);
+        index_->search(query, k + 1, neighbors, result.neighborDistances, context);
+        searchAdded(query, k + 1, neighbors, result.neighborDistances);
+        //An approximate index may miss the sample itself, then the farthest goes
+        size_t drop = std::find(neighbors.begin(), neighbors.end(), i) - neighbors.begin();
+        if(drop == neighbors.size() && int(neighbors.size()) > k) {
+            drop = neighbors.size() - 1;
+        }
+        if(drop < neighbors.size()) {
+            neighbors.erase(neighbors.begin() + drop);
+            result.neighborDistances.erase(result.neighborDistances.begin() + drop);
+        }
+        vote(neighbors, result);
+        expected.push_back(sampleLabels_[i]);
+    }
+}
+
+void object_classifier::searchAdded(const float* query, int k, std::vector<int>& indices,
+                                    std::vector<float>& distances) const {
+    for(int i = 0; i < addedFeatures_.rows; i++) {
+        const float distance = squaredDistance(query, addedFeatures_.ptr<float>(i), addedFeatures_.cols);
+        if(int(indices.size()) >= k && distance >= distances.back()) {
+            continue;
+        }
+        const size_t at = std::upper_bound(distances.begin(), distances.end(), distance) - distances.begin();
+        distances.insert(distances.begin() + at, distance);
+        indices.insert(indices.begin() + at, index_->size() + i);
+        if(int(indices.size()) > k) {
+            distances.pop_back();
+            indices.pop_back();
+        }
+    }
+}
+
+bool object_classifier::addSample(const cv::Mat& bgrImage, const std::string& name, classification_context& context) {
+    preprocess(bgrImage, context.sample, context.row, context);
+    boost::unique_lock<boost::shared_mutex> lock(modelMutex_);
+    if(!index_ || context.row.cols != pca_.mean.cols) {
+        return false;
+    }
+    projectRow(context.row, context.projected, context);
+    int label = -1;
+    for(std::map<int, std::string>::const_iterator i = intToDesc_.begin(); i != intToDesc_.end(); ++i) {
+        if(i->second == name) {
+            label = i->first;
+        }
+    }
+    if(label < 0) {
+        label = intToDesc_.empty() ? 0 : intToDesc_.rbegin()->first + 1;
+        intToDesc_[label] = name;
+    }
+    addedRows_.push_back(context.row);
+    addedFeatures_.push_back(context.projected);
+    sampleLabels_.push_back(label);
+    context.cascadeFeature.resize(cascade_.featureLength());
+    cascade_.features(context.sample, &context.cascadeFeature[0]);
+    cascade_.add(label, &context.cascadeFeature[0]);
+    return true;
+}
+
+int object_classifier::addedSamples() const {
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    return addedRows_.rows;
+}
+
+//Incremental PCA after Ross et al., "Incremental Learning for Robust Visual
+//Tracking": the old basis scaled by its singular values, the centered new rows
+//and the shift of the mean span the covariance of all samples, so the SVD of
+//these few rows gives the new basis without the old samples. The old samples are
+//re-projected from their old projections, mean + f V in input space is f V V'^T +
+//(mean - mean') V'^T on the new basis.
+bool object_classifier::updateModel() {
+    boost::lock_guard<boost::mutex> updating(updateMutex_);
+    cv::Mat mean, eigenvalues, eigenvectors, features, rows;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+        if(!index_ || addedRows_.empty()) {
+            return false;
+        }
+        //The members are only ever replaced, these headers keep the current data
+        mean = pca_.mean;
+        pca_.eigenvalues.convertTo(eigenvalues, CV_32F);
+        eigenvectors = pca_.eigenvectors;
+        features = features_;
+        rows = addedRows_.clone();
+    }
+    const int n = features.rows, m = rows.rows, k = eigenvectors.rows, d = mean.cols;
+
+    cv::Mat batchMean;
+    cv::reduce(rows, batchMean, 0, CV_REDUCE_AVG);
+    cv::Mat stacked(k + m + 1, d, CV_32FC1);
+    for(int i = 0; i < k; i++) {
+        eigenvectors.row(i).convertTo(stacked.row(i), CV_32F, std::sqrt(double(n) * std::max(0.0f, eigenvalues.at<float>(i))));
+    }
+    for(int i = 0; i < m; i++) {
+        cv::subtract(rows.row(i), batchMean, stacked.row(k + i));
+    }
+    cv::Mat shift = mean - batchMean;
+    shift.convertTo(stacked.row(k + m), CV_32F, std::sqrt(double(n) * m / (n + m)));
+    cv::SVD svd(stacked, cv::SVD::MODIFY_A);
+
+    //As many components as the retained variance needs, but not fewer than before
+    double total = 0;
+    for(int i = 0; i < svd.w.rows; i++) {
+        total += double(svd.w.at<float>(i)) * svd.w.at<float>(i);
+    }
+    int components = 0;
+    for(double retained = 0; components < svd.w.rows && retained < params_.pcaAccuracy * total; components++) {
+        retained += double(svd.w.at<float>(components)) * svd.w.at<float>(components);
+    }
+    components = std::min(svd.w.rows, std::max(components, k));
+
+    cv::Mat newMean = (mean * n + batchMean * m) / (n + m);
+    cv::Mat newVectors = svd.vt.rowRange(0, components).clone();
+    cv::Mat newValues(components, 1, CV_32FC1);
+    for(int i = 0; i < components; i++) {
+        newValues.at<float>(i) = svd.w.at<float>(i) * svd.w.at<float>(i) / (n + m);
+    }
+    cv::Mat newFeatures(n + m, components, CV_32FC1);
+    cv::Mat oldFeatures = newFeatures.rowRange(0, n);
+    cv::gemm(features, eigenvectors * newVectors.t(), 1, cv::Mat(), 0, oldFeatures);
+    const cv::Mat meanShift = (mean - newMean) * newVectors.t();
+    for(int i = 0; i < n; i++) {
+        cv::add(oldFeatures.row(i), meanShift, oldFeatures.row(i));
+    }
+    cv::Mat centered = rows - cv::repeat(newMean, m, 1);
+    cv::Mat addedFeatures = newFeatures.rowRange(n, n + m);
+    cv::gemm(centered, newVectors, 1, cv::Mat(), 0, addedFeatures, cv::GEMM_2_T);
+
+    neighbor_index* index = neighbor_index::create(params_.index);
+    if(!index) {
+        return false;
+    }
+    index->build(newFeatures);
+
+    boost::unique_lock<boost::shared_mutex> lock(modelMutex_);
+    pca_.mean = newMean;
+    pca_.eigenvalues = newValues;
+    pca_.eigenvectors = newVectors;
+    index_.reset(index);
+    features_ = newFeatures;
+    //Samples added meanwhile stay added, on the new basis
+    cv::Mat later = addedRows_.rowRange(m, addedRows_.rows).clone();
+    addedRows_.release();
+    addedFeatures_.release();
+    classification_context context;
+    for(int i = 0; i < later.rows; i++) {
+        projectRow(later.row(i), context.projected, context);
+        addedRows_.push_back(later.row(i));
+        addedFeatures_.push_back(context.projected);
+    }
+    //Nothing points into the mapped model any more
+    modelFile_.reset();
+    std::cout << "Updated the model with " << m << " samples, " << components << " components" << std::endl;
+    return true;
+}
+
+std::map<int, std::string> object_classifier::labels() const {
+    boost::shared_lock<boost::shared_mutex> lock(modelMutex_);
+    return intToDesc_;
+}
+
+void object_classifier::vote(const std::vector<int>& neighbors, classification_result& result) const {
+    result.neighborLabels.resize(neighbors.size());
+    for(size_t i = 0; i < neighbors.size(); i++) {
+        result.neighborLabels[i] = sampleLabels_[neighbors[i]];
+    }
+    result.label = voteNeighbors(result.neighborLabels, result.votes);
+    result.cascade = false;
+    result.colorConsistent = true;
+    std::map<int, std::string>::const_iterator name = intToDesc_.find(result.label);
+    result.name = name != intToDesc_.end() ? name->second : std::string();
+}
+
+object_classifier::image_paths object_classifier::readTestImagePaths(const std::string& directory) {
+    image_paths objects;
+    DIR* dirPtr;
+    dirent* entry;
+
+    if((dirPtr = opendir(directory.c_str())) == NULL) {
+        std::cout << "Could not open directory for training" << std::endl;
+        return objects;
+    }
+
+    entry = readdir(dirPtr);
+    while(entry != NULL) {
+        if(entry->d_type == DT_DIR && entry->d_name[0] != '.') objects.push_back(make_pair(std::string(entry->d_name), std::vector<std::string>()));
+        entry = readdir(dirPtr);
+    }
+    closedir(dirPtr);
+    for(size_t i = 0; i < objects.size(); i++) {
+        if((dirPtr = opendir((directory + objects[i].first).c_str())) == NULL) {
+            continue;
+        }
+        entry = readdir(dirPtr);
+        while(entry != NULL) {
+            if(entry->d_type != DT_DIR) objects[i].second.push_back(entry->d_name);
+            entry = readdir(dirPtr);
+        }
+        closedir(dirPtr);
+    }
+
+    return objects;
+}
+
+cv::Mat object_classifier::matToFloatRow(const cv::Mat& input) const {
+    cv::Mat res(1, input.rows*input.cols*params_.attributes, CV_32FC1);
+    matToFloatRow(input, res.ptr<float>(0));
+    return res;
+}
+
+void object_classifier::toSampleSize(cv::Mat& image) const {
+    const cv::Size sampleSize(params_.sampleWidth, params_.sampleHeight);
+    if(image.size() != sampleSize) {
+        cv::resize(image, image, sampleSize, 0, 0, cv::INTER_AREA);
+    }
+}
+
+void object_classifier::matToByteRow(const cv::Mat& input, uchar* row) const {
+    const int attributes = params_.attributes;
+    for(int x = 0; x < input.rows; x++) {
+        const cv::Vec3b* pixel = input.ptr<cv::Vec3b>(x);
+        for(int y = 0; y < input.cols; y++) {
+            for(int a = 0; a < attributes; a++) {
+                *row++ = pixel[y][a];
+            }
+        }
+    }
+}
+
+void object_classifier::matToFloatRow(const cv::Mat& input, float* row) const {
+    const int attributes = params_.attributes;
+    for(int x = 0; x < input.rows; x++) {
+        const cv::Vec3b* pixel = input.ptr<cv::Vec3b>(x);
+        for(int y = 0; y < input.cols; y++) {
+            for(int a = 0; a < attributes; a++) {
+                *row++ = float(pixel[y][a]);
+            }
+        }
+    }
+}
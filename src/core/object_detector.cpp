@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+#include <object_recognition/object_detector.h>
+#include <object_recognition/stage_profiler.h>
+
+object_detector::object_detector() :
+    timing_(true)
+{
+    configure(params_);
+}
+
+bool object_detector::configure(const detector_params& params) {
+    params_ = params;
+    params_.pyramidScale = std::max(1, params_.pyramidScale);
+    depthFilter_.setBox(params_.cropMin, params_.cropMax);
+    depthFilter_.setRoi(params_.roi);
+    tracker_.configure(params_.tracking, params_.trackingPadding, params_.trackingRefresh);
+    return labeler_.compile(params_.ranges);
+}
+
+void object_detector::rangesChanged() {
+    labeler_.compile(params_.ranges);
+}
+
+void object_detector::detect(const detection_input& frame, std::vector<detected_object>& objects, bool all) {
+    timings_.clear();
+    scoped_timer timer(timings_.total, timing_);
+    objects.clear();
+
+    //While objects are tracked only their surroundings are segmented
+    const cv::Rect image(0, 0, frame.image.cols, frame.image.rows);
+    const cv::Rect region = tracker_.searchRegion(image.size());
+    cv::Rect found = search(frame, region, objects, all);
+    //A lost track is searched for in the whole image right away, not only at the next refresh
+    if(found.area() == 0 && region != image) {
+        found = search(frame, image, objects, all);
+    }
+    tracker_.update(found);
+}
+
+cv::Rect object_detector::search(const detection_input& frame, const cv::Rect& region, std::vector<detected_object>& objects,
+                                 bool all) {
+    std::vector<object_candidate> candidates;
+    if(params_.pyramidScale > 1 && region.size() == frame.image.size()) {
+        segmentPyramid(frame, region, candidates);
+    } else {
+        segment(frame, region, candidates);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    cv::Rect found;
+    scoped_timer extractionTimer(timings_.extraction, timing_);
+    const size_t count = all ? candidates.size() : std::min<size_t>(1, candidates.size());
+    for(size_t i = 0; i < count; ++i) {
+        detected_object object;
+        if(!extract(frame, candidates[i], object)) {
+            continue;
+        }
+        found = found.area() > 0 ? (found | object.rect) : object.rect;
+        objects.push_back(object);
+    }
+    return found;
+}
+
+//Blurs and labels the image inside region and collects the contours of every
+//color that pass the area filters. The contours are in image coordinates.
+void object_detector::segment(const detection_input& frame, const cv::Rect& region, std::vector<object_candidate>& candidates) {
+    segmentedRegion_ = region;
+    {
+        //Both depth masks in one pass over the cloud
+        scoped_timer timer(timings_.depth, timing_);
+        depthFilter_.apply(frame.cloud, frame.cameraToRobot, region, depthMaskIncluded_, depthMaskExcluded_);
+    }
+    {
+        scoped_timer timer(timings_.blur, timing_);
+        cv::medianBlur(frame.image(region), blurredImage_, params_.blurSize);
+        cv::cvtColor(blurredImage_, blurredImage_, CV_BGR2HSV);
+    }
+    {
+        //One pass over the region for all colors, the depth masks are already applied
+        scoped_timer timer(timings_.labeling, timing_);
+        labeler_.label(blurredImage_, depthMaskIncluded_, depthMaskExcluded_);
+    }
+
+    scoped_timer timer(timings_.contours, timing_);
+    for(int i = 0; i < labeler_.classCount(); ++i) {
+        if(!labeler_.present(i)) {
+            continue;
+        }
+        labeler_.classMask(i, contourMask_);
+
+        std::vector<std::vector<cv::Point> > contours;
+        std::vector<cv::Vec4i> notUsedHierarchy;
+
+        cv::findContours(contourMask_, contours, notUsedHierarchy, CV_RETR_LIST, CV_CHAIN_APPROX_NONE, region.tl());
+        for(size_t j = 0; j < contours.size(); ++j) {
+            double area = cv::contourArea(contours[j]);
+            if(area > params_.areaMin && area < params_.areaMax) {
+                candidates.push_back(object_candidate(i, area, contours[j]));
+            }
+        }
+    }
+}
+
+//Finds blobs on an image downsampled by pyramidScale and only segments the
+//surroundings of those blobs at full resolution
+void object_detector::segmentPyramid(const detection_input& frame, const cv::Rect& region, std::vector<object_candidate>& candidates) {
+    const int scale = params_.pyramidScale;
+    {
+        scoped_timer timer(timings_.depth, timing_);
+        depthFilter_.apply(frame.cloud, frame.cameraToRobot, region, depthMaskIncluded_, depthMaskExcluded_, scale);
+    }
+    {
+        //Same size as the depth masks, which sample every scale-th point
+        scoped_timer timer(timings_.blur, timing_);
+        cv::resize(frame.image(region), coarseImage_, depthMaskIncluded_.size(), 0, 0, cv::INTER_AREA);
+        //The kernel shrinks with the image, but stays odd
+        cv::medianBlur(coarseImage_, coarseImage_, std::max(3, (params_.blurSize/scale) | 1));
+        cv::cvtColor(coarseImage_, coarseImage_, CV_BGR2HSV);
+    }
+    {
+        scoped_timer timer(timings_.labeling, timing_);
+        labeler_.label(coarseImage_, depthMaskIncluded_, depthMaskExcluded_);
+    }
+
+    std::vector<cv::Rect> refine;
+    {
+        //Generous limits, the exact ones are applied at full resolution
+        scoped_timer timer(timings_.contours, timing_);
+        const double coarseMin = 0.5 * params_.areaMin / (scale*scale);
+        const double coarseMax = 2.0 * params_.areaMax / (scale*scale);
+        const cv::Rect image(0, 0, frame.image.cols, frame.image.rows);
+        for(int i = 0; i < labeler_.classCount(); ++i) {
+            if(!labeler_.present(i)) {
+                continue;
+            }
+            labeler_.classMask(i, contourMask_);
+
+            std::vector<std::vector<cv::Point> > contours;
+            std::vector<cv::Vec4i> notUsedHierarchy;
+            cv::findContours(contourMask_, contours, notUsedHierarchy, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+            for(size_t j = 0; j < contours.size(); ++j) {
+                double area = cv::contourArea(contours[j]);
+                if(area < coarseMin || area > coarseMax) {
+                    continue;
+                }
+                //Back to image coordinates, with a margin for the blur and the sampling
+                cv::Rect rect = cv::boundingRect(contours[j]);
+                const int margin = 2*scale + params_.blurSize;
+                rect = cv::Rect(region.x + rect.x*scale - margin, region.y + rect.y*scale - margin,
+                                rect.width*scale + 2*margin, rect.height*scale + 2*margin) & image;
+                refine.push_back(rect);
+            }
+        }
+
+        //Overlapping rects are merged, otherwise an object could be found twice.
+        //A grown rect can overlap one it was already checked against, so this
+        //repeats until nothing changes.
+        bool merged = true;
+        while(merged) {
+            merged = false;
+            for(size_t i = 0; i < refine.size(); ++i) {
+                for(size_t j = i + 1; j < refine.size(); ) {
+                    if((refine[i] & refine[j]).area() > 0) {
+                        refine[i] |= refine[j];
+                        refine.erase(refine.begin() + j);
+                        merged = true;
+                    } else {
+                        ++j;
+                    }
+                }
+            }
+        }
+    }
+
+    for(size_t i = 0; i < refine.size(); ++i) {
+        segment(frame, refine[i], candidates);
+    }
+}
+
+//Moves a candidate into 3D, false if it has too few finite points
+bool object_detector::extract(const detection_input& frame, const object_candidate& candidate, detected_object& object) {
+    object.validPoints = extractor_.extract(candidate.contour, frame.cloud, frame.cameraToRobot);
+    if(object.validPoints < size_t(params_.minPoints)) {
+        return false;
+    }
+    object.centroid = extractor_.centroid().head<3>();
+    object.colorIndex = candidate.colorIndex;
+    object.color = params_.ranges[candidate.colorIndex].color;
+    object.area = candidate.area;
+    object.contour = candidate.contour;
+    object.rect = cv::boundingRect(candidate.contour);
+    object.cropRect = paddedRect(object.rect, frame.image.rows, frame.image.cols);
+    return true;
+}
+
+//Pads the bounding rect of an object, clipped to the image
+cv::Rect object_detector::paddedRect(cv::Rect objRect, int rows, int cols) const {
+    const int padding = params_.rectPadding;
+    objRect.x = std::max(0, objRect.x - padding);
+    objRect.y = std::max(0, objRect.y - padding);
+    objRect.height = std::min(rows - objRect.y, objRect.height + 2*padding + params_.heightCorrection);
+    objRect.width = std::min(cols - objRect.x, objRect.width + 2*padding);
+    return objRect;
+}
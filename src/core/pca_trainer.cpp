@@ -0,0 +1,223 @@
+#include <cmath>
+#include <algorithm>
+#include <object_recognition/pca_trainer.h>
+
+namespace {
+    //Columns first to first + count of samples as centered floats
+    void centeredColumns(const cv::Mat& samples, const cv::Mat& mean, int first, int count, cv::Mat& block) {
+        samples.colRange(first, first + count).convertTo(block, CV_32F);
+        const float* m = mean.ptr<float>(0) + first;
+        for(int r = 0; r < block.rows; ++r) {
+            float* row = block.ptr<float>(r);
+            for(int c = 0; c < count; ++c) {
+                row[c] -= m[c];
+            }
+        }
+    }
+
+    void centeredRows(const cv::Mat& samples, const cv::Mat& mean, int first, int count, cv::Mat& block) {
+        samples.rowRange(first, first + count).convertTo(block, CV_32F);
+        const float* m = mean.ptr<float>(0);
+        for(int r = 0; r < block.rows; ++r) {
+            float* row = block.ptr<float>(r);
+            for(int c = 0; c < block.cols; ++c) {
+                row[c] -= m[c];
+            }
+        }
+    }
+
+    //The Gram matrix Ac Ac^T or the covariance Ac^T Ac of the centered samples
+    //Ac, applied a block of samples at a time without ever forming it
+    class centered_product {
+    public:
+        centered_product(const cv::Mat& samples, const cv::Mat& mean, int block, bool gram) :
+            samples_(samples), mean_(mean), block_(block), gram_(gram)
+        {
+        }
+
+        int size() const { return gram_ ? samples_.rows : samples_.cols; }
+
+        //The sum of the squared centered samples
+        double trace() const {
+            double sum = 0;
+            cv::Mat chunk;
+            for(int r = 0; r < samples_.rows; r += block_) {
+                centeredRows(samples_, mean_, r, std::min(block_, samples_.rows - r), chunk);
+                sum += cv::norm(chunk, cv::NORM_L2SQR);
+            }
+            return sum;
+        }
+
+        //product = q M, the rows of q have size() entries. M is symmetric, so
+        //this is (M q^T)^T.
+        void apply(const cv::Mat& q, cv::Mat& product) const {
+            product = cv::Mat::zeros(q.rows, size(), CV_32F);
+            cv::Mat chunk, t, part;
+            if(gram_) {
+                //q Ac Ac^T, over blocks of columns C: the sum of (q C) C^T
+                for(int c = 0; c < samples_.cols; c += block_) {
+                    centeredColumns(samples_, mean_, c, std::min(block_, samples_.cols - c), chunk);
+                    cv::gemm(q, chunk, 1, cv::noArray(), 0, t);
+                    cv::gemm(t, chunk, 1, cv::noArray(), 0, part, cv::GEMM_2_T);
+                    product += part;
+                }
+            } else {
+                //q Ac^T Ac, over blocks of rows B: the sum of (q B^T) B
+                for(int r = 0; r < samples_.rows; r += block_) {
+                    const int count = std::min(block_, samples_.rows - r);
+                    centeredRows(samples_, mean_, r, count, chunk);
+                    cv::gemm(q, chunk, 1, cv::noArray(), 0, t, cv::GEMM_2_T);
+                    cv::gemm(t, chunk, 1, cv::noArray(), 0, part);
+                    product += part;
+                }
+            }
+        }
+
+    private:
+        const cv::Mat& samples_;
+        const cv::Mat& mean_;
+        int block_;
+        bool gram_;
+    };
+
+    //Makes the rows of q orthonormal by whitening: with q q^T = E diag(w) E^T the
+    //rows of diag(w)^-1/2 E^T q are. Done twice, the second pass removes what the
+    //first lost to rounding. Directions the rows do not span are refilled with
+    //random rows and whitened again.
+    void orthonormalizeRows(cv::Mat& q, cv::RNG& rng) {
+        cv::Mat gram, w, e, whitening, whitened;
+        int clean = 0;
+        for(int pass = 0; pass < 6 && clean < 2; ++pass) {
+            cv::mulTransposed(q, gram, false, cv::noArray(), 1, CV_64F);
+            cv::eigen(gram, w, e);
+            const double largest = w.at<double>(0);
+            int rank = 0;
+            while(rank < q.rows && w.at<double>(rank) > 1e-8 * largest) {
+                ++rank;
+            }
+            if(rank > 0) {
+                e.rowRange(0, rank).convertTo(whitening, CV_32F);
+                for(int i = 0; i < rank; ++i) {
+                    cv::Mat row = whitening.row(i);
+                    row *= 1.0 / std::sqrt(w.at<double>(i));
+                }
+                cv::gemm(whitening, q, 1, cv::noArray(), 0, whitened);
+                cv::Mat spanned = q.rowRange(0, rank);
+                whitened.copyTo(spanned);
+            }
+            if(rank < q.rows) {
+                cv::Mat fresh = q.rowRange(rank, q.rows);
+                rng.fill(fresh, cv::RNG::NORMAL, 0, 1);
+            }
+            clean = rank == q.rows ? clean + 1 : 0;
+        }
+    }
+
+    //Leading eigenvalues and eigenvectors, as rows, of m, as many as
+    //retainedVariance of its trace needs. Randomized subspace iteration with
+    //Rayleigh-Ritz; when the subspace is too small it doubles and keeps the
+    //Ritz vectors it has, only the new directions start random.
+    void leadingEigen(const centered_product& m, const pca_trainer_params& params, float retainedVariance,
+                      cv::Mat& values, cv::Mat& vectors) {
+        const int size = m.size();
+        const double target = retainedVariance * m.trace();
+        cv::RNG rng(params.seed);
+        int l = std::min(size, std::max(1, params.initialComponents) + params.oversampling);
+        int kept = 0;
+        cv::Mat q, product, small, smallValues, smallVectors, ritz;
+        while(true) {
+            cv::Mat grown(l, size, CV_32F);
+            if(kept > 0) {
+                cv::Mat old = grown.rowRange(0, kept);
+                ritz.copyTo(old);
+            }
+            cv::Mat fresh = grown.rowRange(kept, l);
+            rng.fill(fresh, cv::RNG::NORMAL, 0, 1);
+            q = grown;
+            orthonormalizeRows(q, rng);
+            for(int i = 0; i < params.powerIterations; ++i) {
+                m.apply(q, product);
+                std::swap(q, product);
+                orthonormalizeRows(q, rng);
+            }
+            //Rayleigh-Ritz: the eigenvectors of q m q^T give those of m in the subspace
+            m.apply(q, product);
+            cv::gemm(product, q, 1, cv::noArray(), 0, small, cv::GEMM_2_T);
+            const cv::Mat symmetric = (small + small.t()) * 0.5;
+            cv::eigen(symmetric, smallValues, smallVectors);
+            cv::gemm(smallVectors, q, 1, cv::noArray(), 0, ritz);
+
+            int k = 0;
+            double retained = 0;
+            while(k < l && retained < target && smallValues.at<float>(k) > 0) {
+                retained += smallValues.at<float>(k++);
+            }
+            const bool enough = retained >= target && k <= l - params.oversampling;
+            if(enough || l == size) {
+                k = std::max(1, k);
+                values = smallValues.rowRange(0, k).clone();
+                vectors = ritz.rowRange(0, k).clone();
+                return;
+            }
+            kept = l;
+            l = std::min(size, 2 * l);
+        }
+    }
+}
+
+bool pca_trainer::train(const cv::Mat& samples, float retainedVariance, cv::PCA& pca, cv::Mat& features) const {
+    const int n = samples.rows, d = samples.cols;
+    if(n == 0 || d == 0) {
+        return false;
+    }
+    const int block = std::max(1, params_.blockSize);
+    cv::Mat sum;
+    cv::reduce(samples, sum, 0, CV_REDUCE_SUM, CV_64F);
+    cv::Mat mean;
+    sum.convertTo(mean, CV_32F, 1.0 / n);
+
+    //The eigenvectors live in the smaller of the two spaces
+    const bool gram = n <= d;
+    cv::Mat values, vectors;
+    leadingEigen(centered_product(samples, mean, block, gram), params_, retainedVariance, values, vectors);
+    const int k = values.rows;
+
+    cv::Mat chunk, part, projected;
+    if(gram) {
+        //vectors are U of Ac Ac^T = U S^2 U^T, the components are S^-1 U^T Ac.
+        //The samples are projected onto them in the same pass, U S would differ
+        //for the less accurate trailing components.
+        cv::Mat scaled(k, n, CV_32F);
+        for(int i = 0; i < k; ++i) {
+            const float s = std::sqrt(std::max(values.at<float>(i), 0.0f));
+            cv::Mat row = scaled.row(i);
+            vectors.row(i).convertTo(row, CV_32F, s > 0 ? 1.0 / s : 0.0);
+        }
+        pca.eigenvectors.create(k, d, CV_32F);
+        features = cv::Mat::zeros(n, k, CV_32F);
+        for(int c = 0; c < d; c += block) {
+            const int count = std::min(block, d - c);
+            centeredColumns(samples, mean, c, count, chunk);
+            cv::Mat columns = pca.eigenvectors.colRange(c, c + count);
+            cv::gemm(scaled, chunk, 1, cv::noArray(), 0, part);
+            part.copyTo(columns);
+            cv::gemm(chunk, part, 1, cv::noArray(), 0, projected, cv::GEMM_2_T);
+            features += projected;
+        }
+    } else {
+        //vectors are the components, Ac^T Ac = V S^2 V^T
+        pca.eigenvectors = vectors;
+        features.create(n, k, CV_32F);
+        for(int r = 0; r < n; r += block) {
+            const int count = std::min(block, n - r);
+            centeredRows(samples, mean, r, count, chunk);
+            cv::Mat rows = features.rowRange(r, r + count);
+            cv::gemm(chunk, vectors, 1, cv::noArray(), 0, part, cv::GEMM_2_T);
+            part.copyTo(rows);
+        }
+    }
+    //cv::PCA reports the eigenvalues of the covariance scaled by 1 / n
+    values.convertTo(pca.eigenvalues, CV_32F, 1.0 / n);
+    pca.mean = mean;
+    return true;
+}
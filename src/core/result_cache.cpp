@@ -0,0 +1,102 @@
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgproc/types_c.h>
+#include <object_recognition/result_cache.h>
+
+namespace {
+    int bitCount(boost::uint64_t x) {
+        int bits = 0;
+        for(; x; x &= x - 1) {
+            ++bits;
+        }
+        return bits;
+    }
+}
+
+boost::uint64_t perceptualHash(const cv::Mat& bgrImage) {
+    if(bgrImage.empty()) {
+        return 0;
+    }
+    cv::Mat small, gray;
+    cv::resize(bgrImage, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(small, gray, CV_BGR2GRAY);
+    boost::uint64_t hash = 0;
+    for(int y = 0; y < 8; ++y) {
+        const unsigned char* row = gray.ptr<unsigned char>(y);
+        for(int x = 0; x < 8; ++x) {
+            hash = (hash << 1) | (row[x] < row[x + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+void result_cache::configure(const result_cache_params& params) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    params_ = params;
+    entries_.clear();
+}
+
+result_key result_cache::key(const cv::Mat& bgrImage, const std::string& color, const float* point) const {
+    result_key key;
+    key.color = color;
+    const float bucket = params_.positionBucket > 0 ? params_.positionBucket : 1.0f;
+    for(int i = 0; i < 3; ++i) {
+        key.bucket[i] = int(std::floor(point[i] / bucket));
+    }
+    key.hash = perceptualHash(bgrImage);
+    return key;
+}
+
+bool result_cache::lookup(const result_key& key, double now, classification_result& result) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    for(std::list<entry>::iterator i = entries_.begin(); i != entries_.end(); ) {
+        if(now - i->time > params_.ttl) {
+            i = entries_.erase(i);
+            continue;
+        }
+        if(matches(i->key, key)) {
+            result = i->result;
+            entries_.splice(entries_.begin(), entries_, i);
+            ++hits_;
+            return true;
+        }
+        ++i;
+    }
+    ++misses_;
+    return false;
+}
+
+void result_cache::insert(const result_key& key, double now, const classification_result& result) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if(params_.capacity <= 0) {
+        return;
+    }
+    entry e;
+    e.key = key;
+    e.time = now;
+    e.result = result;
+    entries_.push_front(e);
+    while(int(entries_.size()) > params_.capacity) {
+        entries_.pop_back();
+    }
+}
+
+void result_cache::clear() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+unsigned long result_cache::hits() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return hits_;
+}
+
+unsigned long result_cache::misses() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return misses_;
+}
+
+bool result_cache::matches(const result_key& a, const result_key& b) const {
+    return a.bucket[0] == b.bucket[0] && a.bucket[1] == b.bucket[1] && a.bucket[2] == b.bucket[2] &&
+           a.color == b.color && bitCount(a.hash ^ b.hash) <= params_.maxHashDistance;
+}
@@ -0,0 +1,220 @@
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <object_recognition/sample_pack.h>
+
+using namespace sample_pack_format;
+
+namespace {
+    const char magic[8] = { 'O', 'R', 'P', 'A', 'C', 'K', 0, 0 };
+    const boost::uint64_t labelTableOffset = 128;
+    const boost::uint64_t recordsOffset = labelTableOffset + labelCapacity * labelLength;
+    const int channels = 3;
+
+    //Native byte order, like the model cache
+    struct pack_header {
+        char magic[8];
+        boost::uint32_t version;
+        boost::uint32_t headerSize;
+        boost::int32_t width, height, channels, labelCapacity, labelLength, labelCount, samples, unused;
+        boost::uint64_t stride, labelTable, records;
+    };
+
+    size_t recordStride(int width, int height) {
+        return (8 + size_t(width) * height * channels + 7) / 8 * 8;
+    }
+
+    //Checks everything but the file size
+    bool valid(const pack_header& h) {
+        return memcmp(h.magic, magic, sizeof(magic)) == 0 && h.version == version && h.headerSize == sizeof(pack_header) &&
+            h.width > 0 && h.height > 0 && h.channels == channels &&
+            h.labelCapacity == labelCapacity && h.labelLength == labelLength &&
+            h.labelCount >= 0 && h.labelCount <= labelCapacity && h.samples >= 0 &&
+            h.stride == recordStride(h.width, h.height) && h.labelTable == labelTableOffset && h.records == recordsOffset;
+    }
+
+    std::string labelName(const char* table, int i) {
+        const char* name = table + i * labelLength;
+        return std::string(name, strnlen(name, labelLength - 1));
+    }
+}
+
+sample_pack::sample_pack() :
+    data_(NULL), mapped_(0), records_(NULL), size_(0), width_(0), height_(0), stride_(0)
+{
+}
+
+bool sample_pack::open(const std::string& path) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < static_cast<off_t>(recordsOffset)) {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        return false;
+    }
+    data_ = data;
+    mapped_ = st.st_size;
+
+    const char* base = static_cast<const char*>(data_);
+    pack_header h;
+    memcpy(&h, base, sizeof(h));
+    //Records past the header's count are from an interrupted append and ignored
+    if(!valid(h) || h.records + h.samples * h.stride > mapped_) {
+        close();
+        return false;
+    }
+    //The records are read in order, tell the kernel to read ahead
+    madvise(data_, mapped_, MADV_SEQUENTIAL);
+    records_ = base + h.records;
+    size_ = h.samples;
+    width_ = h.width;
+    height_ = h.height;
+    stride_ = h.stride;
+    for(int i = 0; i < h.labelCount; ++i) {
+        labelNames_.push_back(labelName(base + h.labelTable, i));
+    }
+    return true;
+}
+
+void sample_pack::close() {
+    if(data_) {
+        munmap(data_, mapped_);
+    }
+    data_ = NULL;
+    mapped_ = 0;
+    records_ = NULL;
+    size_ = width_ = height_ = 0;
+    stride_ = 0;
+    labelNames_.clear();
+}
+
+sample_pack_writer::sample_pack_writer() :
+    file_(NULL), size_(0), width_(0), height_(0), stride_(0)
+{
+}
+
+bool sample_pack_writer::open(const std::string& path, int width, int height) {
+    close();
+    labelNames_.clear();
+    file_ = fopen(path.c_str(), "r+b");
+    if(file_) {
+        pack_header h;
+        std::vector<char> table(labelCapacity * labelLength);
+        if(fread(&h, sizeof(h), 1, file_) != 1 || !valid(h) ||
+           fseeko(file_, h.labelTable, SEEK_SET) != 0 || fread(&table[0], table.size(), 1, file_) != 1) {
+            fclose(file_);
+            file_ = NULL;
+            return false;
+        }
+        size_ = h.samples;
+        width_ = h.width;
+        height_ = h.height;
+        stride_ = h.stride;
+        for(int i = 0; i < h.labelCount; ++i) {
+            labelNames_.push_back(labelName(&table[0], i));
+        }
+        //Drops the records of an interrupted append
+        const off_t end = h.records + h.samples * h.stride;
+        if(fflush(file_) != 0 || ftruncate(fileno(file_), end) != 0 || fseeko(file_, end, SEEK_SET) != 0) {
+            fclose(file_);
+            file_ = NULL;
+            return false;
+        }
+    } else {
+        if(width <= 0 || height <= 0) {
+            return false;
+        }
+        file_ = fopen(path.c_str(), "w+b");
+        if(!file_) {
+            return false;
+        }
+        size_ = 0;
+        width_ = width;
+        height_ = height;
+        stride_ = recordStride(width, height);
+        if(!writeHeader() || fseeko(file_, recordsOffset, SEEK_SET) != 0) {
+            fclose(file_);
+            file_ = NULL;
+            return false;
+        }
+    }
+    if((width > 0 && width != width_) || (height > 0 && height != height_)) {
+        fclose(file_);
+        file_ = NULL;
+        return false;
+    }
+    record_.assign(stride_, 0);
+    return true;
+}
+
+bool sample_pack_writer::add(const std::string& labelName, const cv::Mat& image) {
+    if(!file_ || image.type() != CV_8UC3 || image.cols != width_ || image.rows != height_ ||
+       int(labelName.size()) >= labelLength) {
+        return false;
+    }
+    int label = std::find(labelNames_.begin(), labelNames_.end(), labelName) - labelNames_.begin();
+    if(label == int(labelNames_.size())) {
+        if(label >= labelCapacity) {
+            return false;
+        }
+        labelNames_.push_back(labelName);
+    }
+    const boost::int32_t stored = label;
+    memcpy(&record_[0], &stored, sizeof(stored));
+    char* pixels = &record_[8];
+    for(int y = 0; y < height_; ++y) {
+        memcpy(pixels + size_t(y) * width_ * channels, image.ptr(y), width_ * channels);
+    }
+    if(fwrite(&record_[0], stride_, 1, file_) != 1) {
+        return false;
+    }
+    ++size_;
+    return true;
+}
+
+bool sample_pack_writer::close() {
+    if(!file_) {
+        return true;
+    }
+    bool ok = fflush(file_) == 0 && writeHeader();
+    ok = fclose(file_) == 0 && ok;
+    file_ = NULL;
+    return ok;
+}
+
+bool sample_pack_writer::writeHeader() {
+    pack_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.headerSize = sizeof(pack_header);
+    h.width = width_;
+    h.height = height_;
+    h.channels = channels;
+    h.labelCapacity = labelCapacity;
+    h.labelLength = labelLength;
+    h.labelCount = labelNames_.size();
+    h.samples = size_;
+    h.stride = stride_;
+    h.labelTable = labelTableOffset;
+    h.records = recordsOffset;
+    std::vector<char> table(labelCapacity * labelLength, 0);
+    for(size_t i = 0; i < labelNames_.size(); ++i) {
+        memcpy(&table[i * labelLength], labelNames_[i].data(), labelNames_[i].size());
+    }
+    //The label table first, the sample count in the header makes the new records visible
+    return fseeko(file_, labelTableOffset, SEEK_SET) == 0 && fwrite(&table[0], table.size(), 1, file_) == 1 &&
+        fflush(file_) == 0 && fsync(fileno(file_)) == 0 &&
+        fseeko(file_, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, file_) == 1 && fflush(file_) == 0;
+}
@@ -1,8 +1,11 @@
 #include <cstdio>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <ros/ros.h>
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf/transform_listener.h>
 #include <pcl_conversions/pcl_conversions.h>
@@ -22,9 +25,19 @@
 #include <pcl/filters/voxel_grid.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl/filters/statistical_outlier_removal.h>
+#ifdef OBJECT_RECOGNITION_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
 
 #include <robot_msgs/imagePosition.h>
+#include <object_recognition/imageRegionArray.h>
 #include <pcl/common/centroid.h>
+#include <object_recognition/object_detector.h>
+#include <object_recognition/cloud_view.h>
+#include <object_recognition/latest_mailbox.h>
+#include <object_recognition/stage_profiler.h>
+#include <object_recognition/profiler_reporter.h>
 typedef pcl::PCLPointCloud2 Cloud2;
 typedef pcl::PointXYZRGB Point;
 typedef pcl::PointCloud<Point> Cloud;
@@ -40,22 +53,40 @@ typedef pcl::PointCloud<PointHSV> CloudHSV;
     #define DEBUG(X)
 #endif
 
+//Everything detect() needs from one camera frame. A frame is not changed after
+//pointCloudCB handed it over, so it can be passed to the detection thread.
+struct detection_frame {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    //Keeps the buffer of cloud alive
+    sensor_msgs::PointCloud2ConstPtr msg;
+    //Only used when the incoming cloud can not be viewed in place
+    Cloud::Ptr convertedCloud;
+    detection_input input;
+    std_msgs::Header header;
+};
+
+//Runs as its own node or as a nodelet next to object_recognition, see the bottom
 class object_detection{
 public:
-    object_detection() :
-        it_(nh_)
+    explicit object_detection(const ros::NodeHandle& handle = ros::NodeHandle()) :
+        nh_(handle),
+        it_(nh_),
+        reporter_(nh_, profiler_, "object_detection")
     {
-        hsvRanges_.resize(6);
+        setupProfiler();
         loadParams();
+        if(!detector_.configure(params_)) {
+            ROS_WARN("Only the first %d hsv ranges are used", hsv_label_table::maxClasses);
+        }
 
         pcl_sub_ = nh_.subscribe("/camera/depth_registered/points", 1, &object_detection::pointCloudCB, this);
 
-        //img_sub_ = it_.subscribe("/camera/rgb/image_rect_color", 1, &object_detection::imageCB, this);
-
         imgPosition_pub_ = nh_.advertise<robot_msgs::imagePosition>("/object_detection/object_position",1);
         img_pub_ = it_.advertise("/object_detection/object",1);
-
-        currentCloudPtr_ = Cloud::Ptr(new Cloud);
+        if(multiObject_) {
+            objects_pub_ = nh_.advertise<object_recognition::imageRegionArray>("/object_detection/objects",1);
+        }
 
 #ifdef DCB
             pcl_tf_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("/object_detection/transformed", 1);
@@ -69,189 +100,134 @@ public:
             setupHsvTrackbars();
             uiThread = boost::thread(&object_detection::asyncImshow, this);
 #endif
+
+        reporter_.start();
+        if(pipelined_) {
+            detectionThread_ = boost::thread(&object_detection::detectionLoop, this);
+        }
     }
 
     ~object_detection() {
+        if(pipelined_) {
+            detectionThread_.interrupt();
+            detectionThread_.join();
+        }
 #ifdef DCB
             uiThread.interrupt();
             uiThread.join();
 #endif
     }
 
-    void imageCB(const sensor_msgs::ImageConstPtr& img_msg) {
-        DEBUG(std::cout << "Got image callback" << std::endl;)
-        cv_bridge::CvImagePtr cvPtr;
-        try {
-            cvPtr = cv_bridge::toCvCopy(img_msg, "bgr8");
-        }
-        catch (cv_bridge::Exception& e) {
-            ROS_ERROR("cv_bridge exception: %s", e.what());
-            return;
-        }
-        currentImagePtr_ = cvPtr;
-        rows_ = cvPtr->image.rows;
-        cols_ = cvPtr->image.cols;
-        haveImage_ = true;
-    }
-
     void pointCloudCB(const sensor_msgs::PointCloud2ConstPtr& pclMsg) {
         DEBUG(std::cout << "Got pcl callback" << std::endl;)
+        profiler_.count(receivedCounter);
 
-        pcl::fromROSMsg(*pclMsg, *currentCloudPtr_);
         tf::StampedTransform transform;
         try {
             tf_sub_.lookupTransform("robot_center", "camera_rgb_optical_frame", ros::Time(0), transform);
         } catch (tf::TransformException ex){
             ROS_ERROR("%s",ex.what());
+            profiler_.count(skippedCounter);
             return;
         }
-        pcl_ros::transformPointCloud(*currentCloudPtr_, *currentCloudPtr_, transform);
-        currentCloudPtr_->header.frame_id = "robot_center";
-
-        sensor_msgs::PointCloud2 msgOut;
-        pcl::toROSMsg(*currentCloudPtr_, msgOut);
-        //Getting Image from the Cloud
-        sensor_msgs::Image tempImageMsg;
-        pcl::toROSMsg(msgOut,tempImageMsg);
-        currentImagePtr_= cv_bridge::toCvCopy(tempImageMsg, "bgr8");
-        haveImage_=true;
-        currentheader_ = pclMsg->header;
-        rows_ = currentImagePtr_->image.rows;
-        cols_ = currentImagePtr_->image.cols;
-        havePcl_ = true;
+        stage_profiler::scope convertScope(profiler_, convertStage);
+        detection_frame* frame = new detection_frame;
+
+        //The cloud stays in the camera frame, the points are transformed when they are used
+        Eigen::Matrix4f cameraToRobot;
+        pcl_ros::transformAsMatrix(transform, cameraToRobot);
+        frame->input.cameraToRobot.matrix() = cameraToRobot;
+
+        //The points are used in place, only the color is copied out once
+        if(!viewCloud(*pclMsg, frame->input.cloud)) {
+            DEBUG(std::cout << "Unexpected cloud layout, converting it" << std::endl;)
+            frame->convertedCloud = Cloud::Ptr(new Cloud);
+            pcl::fromROSMsg(*pclMsg, *frame->convertedCloud);
+            frame->input.cloud = organized_cloud_view(*frame->convertedCloud);
+        }
+        frame->msg = pclMsg;
+        frame->input.cloud.bgrImage(frame->input.image);
+        frame->header = pclMsg->header;
+
+        //Replaces a frame detect() did not get to yet
+        if(frames_.put(frame)) {
+            profiler_.count(droppedCounter);
+        }
 
 #ifdef DCB
-        //sensor_msgs::PointCloud2 msgOut;
-        pcl::toROSMsg(*currentCloudPtr_, msgOut);
         pcl_tf_pub_.publish(pclMsg);
 #endif
 
     }
 
+    //Runs the detection on the latest frame, if there is a new one
     void detect() {
-        if(!haveImage_ || !havePcl_) {
-            DEBUG(std::cout << "No PCL or image set" << std::endl;)
+        boost::scoped_ptr<detection_frame> frame(frames_.take());
+        if(!frame) {
+            DEBUG(std::cout << "No new PCL and image" << std::endl;)
             return;
         }
+        detect(*frame);
+    }
 
-        cv::Mat depthMaskIncluded = cv::Mat::zeros(rows_, cols_, CV_8UC1);
-        cv::Mat depthMaskExcluded = cv::Mat::zeros(rows_, cols_, CV_8UC1);
-        std::vector<int> indices;
-        cropDepthData(indices, true);
-        for(size_t i = 0; i < indices.size(); ++i) {
-            depthMaskIncluded.at<char>(indices[i]) = 255;
-        }
-
-        indices.clear();
-        cropDepthData(indices, false);
-        for(size_t i = 0; i < indices.size(); ++i) {
-            depthMaskExcluded.at<char>(indices[i]) = 255;
-        }
-
-        cv::Mat HSVmask;
-        cv::Mat blurredImage;
-        cv::Mat combinedMask;
-        cv::medianBlur(currentImagePtr_->image, blurredImage, 9);
-
-#ifdef DCB
-        //cv::imshow("Depth filter", depthMaskExcluded);
-        cv::imshow("Blurred image", blurredImage);
-        cv::Mat savedHSVMask;
-        cv::Mat saveCombinedMask;
-#endif
-        cv::cvtColor(blurredImage, blurredImage, CV_BGR2HSV);
-
-        double largestArea = 0;
-        int largestIndex = 0;
-        std::string largestAreaColor = "";
-        std::vector<cv::Point> largestContour;
-        cv::Mat contourMask;
-        for(size_t i = 0; i < hsvRanges_.size(); ++i) {
-            cv::inRange(blurredImage, hsvRanges_[i].min, hsvRanges_[i].max, HSVmask);
+    bool pipelined() const { return pipelined_; }
 
+private:
+    void detect(const detection_frame& frame) {
+        stage_profiler::scope detectScope(profiler_, detectStage);
 #ifdef DCB
-            if(i == selectedHsvRange_) {
-               cv::imshow("HSV filter", HSVmask);
-            }
+        //The trackbars change the ranges at runtime
+        detector_.rangesChanged();
 #endif
+        const bool profiling = profiler_.enabled();
+        detector_.setTiming(profiling);
+        //Every object is only extracted while someone listens for them
+        const bool all = multiObject_ && objects_pub_.getNumSubscribers() > 0;
+        detector_.detect(frame.input, objects_, all);
+        if(profiling) {
+            const detection_timings& t = detector_.timings();
+            profiler_.record(depthStage, t.depth);
+            profiler_.record(blurStage, t.blur);
+            profiler_.record(labelingStage, t.labeling);
+            profiler_.record(contoursStage, t.contours);
+            profiler_.record(extractionStage, t.extraction);
+            profiler_.count(processedCounter);
+            profiler_.count(objectsCounter, objects_.size());
+        }
 
-            if(hsvRanges_[i].inverted) {
-                cv::bitwise_not(HSVmask, HSVmask);
-            }
-
-            if(hsvRanges_[i].includeInvalid) {
-                combinedMask = HSVmask & depthMaskIncluded;
-            } else {
-                combinedMask = HSVmask & depthMaskExcluded;
-            }
-
-            std::vector<std::vector<cv::Point> > contours;
-            std::vector<cv::Vec4i> notUsedHierarchy;
-
-            contourMask = combinedMask.clone();
-            cv::findContours(contourMask, contours, notUsedHierarchy, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
-            if(contours.size() > 0) {
-                for(size_t j = 0; j < contours.size(); ++j) {
-                    double area = cv::contourArea(contours[j]);
-                    if(area > areaMinThreshold_ && area > largestArea && area < areaMaxThreshold_ ) {
-                        largestArea = area;
-                        largestAreaColor = hsvRanges_[i].color;
-                        largestContour = contours[j];
-                        largestIndex = i;
 #ifdef DCB
-                        savedHSVMask = HSVmask.clone();
-                        saveCombinedMask = combinedMask.clone();
+        cv::Mat blurredImage, HSVmask;
+        cv::cvtColor(detector_.hsvImage(), blurredImage, CV_HSV2BGR);
+        cv::imshow("Blurred image", blurredImage);
+        const hsv_range& selected = detector_.ranges()[selectedHsvRange_];
+        cv::inRange(detector_.hsvImage(), selected.min, selected.max, HSVmask);
+        cv::imshow("HSV filter", HSVmask);
+        if(!objects_.empty()) {
+            cv::Mat combinedMask;
+            detector_.labels().classMask(objects_[0].colorIndex, combinedMask);
+            cv::imshow("Combined filter", combinedMask);
+        }
 #endif
 
-                    }
-                }
-            }
+        stage_profiler::scope publishScope(profiler_, publishStage);
+        if(all) {
+            publishObjects(frame, objects_);
         }
-
-        if(largestContour.size() == 0) {
-            return;
+        if(!objects_.empty()) {
+            publishLargest(frame, objects_[0]);
         }
+    }
+
+    //Publishes the largest object on the single object topics
+    void publishLargest(const detection_frame& frame, const detected_object& largest) {
+        const std::vector<cv::Point>& largestContour = largest.contour;
+        const std::string& largestAreaColor = largest.color;
 
 #ifdef DCB
-        //cv::imshow("HSV filter", savedHSVMask);
-        cv::imshow("Combined filter", saveCombinedMask);
         std::cout << "Color filter used: " << largestAreaColor << std::endl;
 #endif
-
-        //Getting the Position of the largest Contour
-        Cloud objectCloud;
-        cv::Point2f point;
-        //DEBUG(std::cout<< " Try to get a Pointcloud in the largest Contour" << std::endl;)
-        //cv::Mat contourMask  = cv::Mat::zeros(rows_, cols_, CV_8U);
-        int debug=0;
-
-        for(int x=0;x<cols_; x++){
-            for(int y=0;y<rows_; y++){
-                point.x=x;
-                point.y=y;
-
-
-                if(0 <= cv::pointPolygonTest(largestContour,point,false)){
-                    //contourMask.at<char>(x,y)=255;
-                    objectCloud.points.push_back(currentCloudPtr_->at(x,y));
-
-//                    DEBUG(std::cout<< "Pointclouddata:  "<< currentCloudPtr_->at(x,y) << std::endl;)
-                    debug++;
-                }
-            }
-        }
-
-        DEBUG(std::cout<< "Got Pointcloud with " << objectCloud.points.size() << "  Points " << std::endl;)
-        Eigen::Vector4f massCenter;
-        std::vector<int> indicies;
-        Cloud withoutNan;
-        objectCloud.is_dense=false;
-        pcl::removeNaNFromPointCloud(objectCloud,withoutNan,indicies);
-        DEBUG(std::cout<< "Got Pointcloud with "<< withoutNan.points.size()  << "  Points after removing NaN" << std::endl;)
-	if(withoutNan.points.size() < 50){
-		return;
-	}
-        pcl::compute3DCentroid(objectCloud, massCenter);
+        DEBUG(std::cout<< "Got Pointcloud with "<< largest.validPoints  << "  Points after removing NaN" << std::endl;)
+        const Eigen::Vector3f& massCenter = largest.centroid;
 
         DEBUG(std::cout<< "Got massCenter " << massCenter<<std::endl;)
 
@@ -272,155 +248,208 @@ public:
              std::cout << " It is probably A "<< largestAreaColor<<" RECTANGLE !!!!! " << std::endl;
         }
 
-        cv::Rect objRect = cv::boundingRect(largestContour);
+        const cv::Rect& objRect = largest.rect;
 
 #ifdef DCB
-        cv::Point objCenter(objRect.x + objRect.width/2, objRect.y + objRect.height/2);
-        cv::Mat floodMask = cv::Mat::zeros(rows_+2, cols_+2, CV_8UC1);
-        hsvRange& cr = hsvRanges_[largestIndex];
+        const cv::Rect& region = detector_.segmentedRegion();
+        cv::Point objCenter(objRect.x + objRect.width/2 - region.x, objRect.y + objRect.height/2 - region.y);
+        cv::Mat floodMask = cv::Mat::zeros(region.height+2, region.width+2, CV_8UC1);
+        const hsv_range& cr = detector_.ranges()[largest.colorIndex];
         cv::Scalar upDiff(cr.updiffh, cr.updiffs, cr.updiffv);
         cv::Scalar lowDiff(cr.lowdiffh, cr.lowdiffs, cr.lowdiffv);
-        cv::floodFill(blurredImage, floodMask, objCenter, cv::Scalar(0, 0, 0), NULL, lowDiff, upDiff, 8 | CV_FLOODFILL_FIXED_RANGE | CV_FLOODFILL_MASK_ONLY | 255 << 8);
-        cv::medianBlur(floodMask, floodMask, 3);
-        cv::circle(floodMask, objCenter, 3, cv::Scalar(128, 0, 0), 2);
+        //With the pyramid the object can be in another region than the one segmented last
+        if(cv::Rect(0, 0, region.width, region.height).contains(objCenter)) {
+            cv::Mat hsv = detector_.hsvImage().clone();
+            cv::floodFill(hsv, floodMask, objCenter, cv::Scalar(0, 0, 0), NULL, lowDiff, upDiff, 8 | CV_FLOODFILL_FIXED_RANGE | CV_FLOODFILL_MASK_ONLY | 255 << 8);
+            cv::medianBlur(floodMask, floodMask, 3);
+            cv::circle(floodMask, objCenter, 3, cv::Scalar(128, 0, 0), 2);
+        }
         //cv::imshow("Flood mask", floodMask);
 #endif
 
-        objRect.x = std::max(0, objRect.x - rectPadding_);
-        objRect.y = std::max(0, objRect.y - rectPadding_);
-        objRect.height = std::min(rows_ - objRect.y, objRect.height + 2*rectPadding_ + heightCorrection_);
-        objRect.width = std::min(cols_ - objRect.x, objRect.width + 2*rectPadding_);
-        cv::Mat objImgOut = currentImagePtr_->image(objRect);
+        cv::Mat objImgOut = frame.input.image(largest.cropRect);
 
         geometry_msgs::Point dir_msg_out;
         dir_msg_out.x = massCenter[0];
         dir_msg_out.y = massCenter[1];
         dir_msg_out.z = massCenter[2];
 
-        cv_bridge::CvImage img;
-        img.image = objImgOut;
-        sensor_msgs::ImagePtr imgOut = img.toImageMsg();
-        imgOut->encoding = "bgr8";
-        robot_msgs::imagePosition msgOut;
-
-        msgOut.header = currentheader_;
-        msgOut.color=largestAreaColor;
-        msgOut.point=dir_msg_out;
-        msgOut.image = imgOut.operator *();
+        //Published as a shared pointer and not changed afterwards, so a subscriber
+        //in the same process gets this message without it being serialized. The
+        //crop is copied once, into the message.
+        robot_msgs::imagePositionPtr msgOut = boost::make_shared<robot_msgs::imagePosition>();
+        msgOut->header = frame.header;
+        msgOut->color=largestAreaColor;
+        msgOut->point=dir_msg_out;
+        cv_bridge::CvImage(std_msgs::Header(), "bgr8", objImgOut).toImageMsg(msgOut->image);
         imgPosition_pub_.publish(msgOut);
-        img_pub_.publish(imgOut);
+        //Only for viewers, so only copied when one is listening
+        if(img_pub_.getNumSubscribers() > 0) {
+            img_pub_.publish(boost::make_shared<sensor_msgs::Image>(msgOut->image));
+        }
         DEBUG(std::cout<< "Sending Completed " << std::endl;)
     }
 
-
-private:
-    class hsvRange {
-    public:
-
-        hsvRange() :
-            hmin(min[0]), smin(min[1]), vmin(min[2]),
-            hmax(max[0]), smax(max[1]), vmax(max[2])
-        {
-        }
-
-        hsvRange(const hsvRange& other) :
-            hmin(min[0]), smin(min[1]), vmin(min[2]),
-            hmax(max[0]), smax(max[1]), vmax(max[2])
-        {
-            min = other.min;
-            max = other.max;
-        }
-
-        hsvRange& operator=(const hsvRange& other) {
-            min = other.min;
-            max = other.max;
+    //Publishes every detected object of the frame in one message
+    void publishObjects(const detection_frame& frame, const std::vector<detected_object>& objects) {
+        object_recognition::imageRegionArray msgOut;
+        msgOut.header = frame.header;
+        msgOut.regions.resize(objects.size());
+        for(size_t i = 0; i < objects.size(); ++i) {
+            const detected_object& object = objects[i];
+            object_recognition::imageRegion& region = msgOut.regions[i];
+            region.color = object.color;
+            region.point.x = object.centroid[0];
+            region.point.y = object.centroid[1];
+            region.point.z = object.centroid[2];
+            region.rect.x_offset = object.cropRect.x;
+            region.rect.y_offset = object.cropRect.y;
+            region.rect.width = object.cropRect.width;
+            region.rect.height = object.cropRect.height;
+            cv_bridge::CvImage(frame.header, "bgr8", frame.input.image(object.cropRect)).toImageMsg(region.image);
         }
+        objects_pub_.publish(msgOut);
+        DEBUG(std::cout<< "Sent " << msgOut.regions.size() << " objects" << std::endl;)
+    }
 
-        template <typename T> void setValues(const T& hmin, const T& smin, const T& vmin,
-                                             const T& hmax, const T& smax, const T& vmax) {
-            this->hmin = hmin;
-            this->smin = smin;
-            this->vmin = vmin;
-            this->hmax = hmax;
-            this->smax = smax;
-            this->vmax = vmax;
+    //Detection thread of the pipelined mode, runs detect() on every new frame
+    //but at most maxRate_ times per second
+    void detectionLoop() {
+        boost::scoped_ptr<ros::Rate> rate;
+        if(maxRate_ > 0) {
+            rate.reset(new ros::Rate(maxRate_));
         }
-
-        std::string color;
-
-        cv::Scalar min;
-        cv::Scalar max;
-
-        bool inverted;
-	bool includeInvalid;
-        double& hmin;
-        double& smin;
-        double& vmin;
-        double& hmax;
-        double& smax;
-        double& vmax;
-        double updiffh, updiffs, updiffv;
-        double lowdiffh, lowdiffs, lowdiffv;
-    };
-
-    void cropDepthData(std::vector<int>& outIndices, bool includeInvalid =true) {
-        for(int index = 150*cols_; index < rows_*cols_; ++index) {
-            Point& cp = currentCloudPtr_->at(index);
-            if(includeInvalid && isnan(cp.x)) {
-                outIndices.push_back(index);
-            } else if(
-                    cp.y >= cbMin_[1] &&
-                    cp.y <= cbMax_[1] &&
-                    cp.x >= cbMin_[0] &&
-                    cp.x <= cbMax_[0] &&
-                    cp.z >= cbMin_[2] &&
-                    cp.z <= cbMax_[2]) {
-                outIndices.push_back(index);
+        while(true) {
+            try {
+                boost::this_thread::interruption_point();
+                boost::scoped_ptr<detection_frame> frame(frames_.waitTake(boost::posix_time::milliseconds(100)));
+                if(!frame) {
+                    continue;
+                }
+                detect(*frame);
+                if(rate) {
+                    rate->sleep();
+                }
+            } catch(boost::thread_interrupted&) {
+                return;
             }
         }
     }
 
+    //Stages and counters of the profiler, in the order setupProfiler() adds them
+    enum { convertStage, depthStage, blurStage, labelingStage, contoursStage, extractionStage, publishStage, detectStage };
+    enum { receivedCounter, droppedCounter, skippedCounter, processedCounter, objectsCounter };
+
+    void setupProfiler() {
+        profiler_.addStage("convert");
+        profiler_.addStage("depth");
+        profiler_.addStage("blur");
+        profiler_.addStage("labeling");
+        profiler_.addStage("contours");
+        profiler_.addStage("extraction");
+        profiler_.addStage("publish");
+        profiler_.addStage("detect");
+        profiler_.addCounter("received");
+        profiler_.addCounter("dropped");
+        profiler_.addCounter("skipped");
+        profiler_.addCounter("processed");
+        profiler_.addCounter("objects");
+    }
+
     void loadParams(){
-        getParam("object_detection/crop/wMin", cbMin_[0], -10);
-        getParam("object_detection/crop/dMin", cbMin_[1], -10);
-        getParam("object_detection/crop/hMin", cbMin_[2], -10);
-        getParam("object_detection/crop/wMax", cbMax_[0], 10);
-        getParam("object_detection/crop/dMax", cbMax_[1], 10);
-        getParam("object_detection/crop/hMax", cbMax_[2], 10);
+        getParam("object_detection/crop/wMin", params_.cropMin[0], -10);
+        getParam("object_detection/crop/dMin", params_.cropMin[1], -10);
+        getParam("object_detection/crop/hMin", params_.cropMin[2], -10);
+        getParam("object_detection/crop/wMax", params_.cropMax[0], 10);
+        getParam("object_detection/crop/dMax", params_.cropMax[1], 10);
+        getParam("object_detection/crop/hMax", params_.cropMax[2], 10);
+
+        //Only this part of the image is searched for objects, the default skips the upper 150 rows
+        int roiX, roiY, roiWidth, roiHeight;
+        getParam("object_detection/roi/x", roiX, 0);
+        getParam("object_detection/roi/y", roiY, 150);
+        getParam("object_detection/roi/width", roiWidth, 0);
+        getParam("object_detection/roi/height", roiHeight, 0);
+        params_.roi = cv::Rect(roiX, roiY, roiWidth, roiHeight);
 
         getParam("object_detection/voxel/leafsize", voxelsize_, 0.005);
-        getParam("object_detection/rectPadding", rectPadding_, 5);
+        getParam("object_detection/rectPadding", params_.rectPadding, 5);
+
+        getParam("object_detection/heightCorrection", params_.heightCorrection, 10);
+        getParam("object_detection/minArea", params_.areaMin, 1000);
+        getParam("object_detection/maxArea", params_.areaMax, 6000);
+
+        //Pipelined: detect on a separate thread as frames arrive instead of polling at 5 Hz
+        getParam("object_detection/pipelined", pipelined_, false);
+        getParam("object_detection/maxRate", maxRate_, 0);
+
+        //Also publish every object of a frame on /object_detection/objects, not only the largest.
+        //They are only extracted in frames the topic has subscribers.
+        getParam("object_detection/multiObject", multiObject_, false);
+
+        //After a detection only search around it, with a full search every refreshInterval frames
+        getParam("object_detection/tracking/enabled", params_.tracking, false);
+        getParam("object_detection/tracking/padding", params_.trackingPadding, 40);
+        getParam("object_detection/tracking/refreshInterval", params_.trackingRefresh, 10);
 
-        getParam("object_detection/heightCorrection", heightCorrection_, 10);
-        getParam("object_detection/minArea", areaMinThreshold_, 1000);
-        getParam("object_detection/maxArea", areaMaxThreshold_, 6000);
+        //Full frame searches find candidates on an image this many times smaller first, 1 turns it off
+        getParam("object_detection/pyramid/scale", params_.pyramidScale, 1);
 
 
         std::string hsvParamName("object_detection/hsv");
-        for(size_t i = 0; i < hsvRanges_.size(); ++i) {
+        std::vector<hsv_range>& hsvRanges = params_.ranges;
+        hsvRanges.resize(6);
+        for(size_t i = 0; i < hsvRanges.size(); ++i) {
             std::stringstream ss; ss << hsvParamName << i;
-            getParam(ss.str() + "/hmin", hsvRanges_[i].hmin, 10);
-            getParam(ss.str() + "/smin", hsvRanges_[i].smin, 10);
-            getParam(ss.str() + "/vmin", hsvRanges_[i].vmin, 10);
-            getParam(ss.str() + "/hmax", hsvRanges_[i].hmax, 180);
-            getParam(ss.str() + "/smax", hsvRanges_[i].smax, 255);
-            getParam(ss.str() + "/vmax", hsvRanges_[i].vmax, 255);
+            getParam(ss.str() + "/hmin", hsvRanges[i].hmin, 10);
+            getParam(ss.str() + "/smin", hsvRanges[i].smin, 10);
+            getParam(ss.str() + "/vmin", hsvRanges[i].vmin, 10);
+            getParam(ss.str() + "/hmax", hsvRanges[i].hmax, 180);
+            getParam(ss.str() + "/smax", hsvRanges[i].smax, 255);
+            getParam(ss.str() + "/vmax", hsvRanges[i].vmax, 255);
 
-            getParam(ss.str() + "/updiffh", hsvRanges_[i].updiffh, 0);
-            getParam(ss.str() + "/updiffs", hsvRanges_[i].updiffs, 0);
-            getParam(ss.str() + "/updiffv", hsvRanges_[i].updiffv, 0);
+            getParam(ss.str() + "/updiffh", hsvRanges[i].updiffh, 0);
+            getParam(ss.str() + "/updiffs", hsvRanges[i].updiffs, 0);
+            getParam(ss.str() + "/updiffv", hsvRanges[i].updiffv, 0);
 
-            getParam(ss.str() + "/lowdiffh", hsvRanges_[i].lowdiffh, 0);
-            getParam(ss.str() + "/lowdiffs", hsvRanges_[i].lowdiffs, 0);
-            getParam(ss.str() + "/lowdiffv", hsvRanges_[i].lowdiffv, 0);
+            getParam(ss.str() + "/lowdiffh", hsvRanges[i].lowdiffh, 0);
+            getParam(ss.str() + "/lowdiffs", hsvRanges[i].lowdiffs, 0);
+            getParam(ss.str() + "/lowdiffv", hsvRanges[i].lowdiffv, 0);
 
-            getParam(ss.str() + "/color", hsvRanges_[i].color, "");
-            getParam(ss.str() + "/inverted", hsvRanges_[i].inverted, false);
-            getParam(ss.str() + "/includeinvalid", hsvRanges_[i].includeInvalid, true);
+            getParam(ss.str() + "/color", hsvRanges[i].color, "");
+            getParam(ss.str() + "/inverted", hsvRanges[i].inverted, false);
+            getParam(ss.str() + "/includeinvalid", hsvRanges[i].includeInvalid, true);
 
         }
     }
 
+    //Views the points of the message in place if x, y, z and rgb have the layout of pcl::PointXYZRGB
+    static bool viewCloud(const sensor_msgs::PointCloud2& msg, organized_cloud_view& view) {
+        int x = -1, y = -1, z = -1, rgb = -1;
+        for(size_t i = 0; i < msg.fields.size(); ++i) {
+            const sensor_msgs::PointField& field = msg.fields[i];
+            if(field.name == "rgb" || field.name == "rgba") {
+                rgb = field.offset;
+            } else if(field.datatype != sensor_msgs::PointField::FLOAT32) {
+                continue;
+            } else if(field.name == "x") {
+                x = field.offset;
+            } else if(field.name == "y") {
+                y = field.offset;
+            } else if(field.name == "z") {
+                z = field.offset;
+            }
+        }
+        //The crop box test loads x, y, z and the following 4 bytes at once
+        if(msg.is_bigendian || msg.height < 2 || x < 0 || y != x + 4 || z != x + 8 || rgb < 0 ||
+                int(msg.point_step) < x + 16 || int(msg.point_step) < rgb + 3 ||
+                msg.data.size() < size_t(msg.row_step)*msg.height) {
+            return false;
+        }
+        view = organized_cloud_view(&msg.data[0], msg.width, msg.height, msg.point_step, msg.row_step, x, rgb);
+        return true;
+    }
+
     template <typename T1, typename T2> bool getParam(const std::string paramName, T1& variable, const T2& standardValue) {
         if(nh_.hasParam(paramName)) {
             nh_.getParam(paramName, variable);
@@ -462,7 +491,7 @@ private:
         //Setup all the UI trackbars when debugging
         void setupHsvTrackbars() {
             cv::namedWindow("HSVTrackbars",CV_WINDOW_NORMAL);
-            cv::createTrackbar("Index", "HSVTrackbars", &selectedHsvRange_, hsvRanges_.size()-1);
+            cv::createTrackbar("Index", "HSVTrackbars", &selectedHsvRange_, detector_.ranges().size()-1);
             cv::createTrackbar("Hmin", "HSVTrackbars", NULL, 180);
             cv::createTrackbar("Hmax", "HSVTrackbars", NULL, 180);
             cv::createTrackbar("Smin", "HSVTrackbars", NULL, 255);
@@ -483,20 +512,20 @@ private:
             selectedHsvRange_ = cv::getTrackbarPos("Index", "HSVTrackbars");
             if(lastHsvRange_ != selectedHsvRange_) {
                 lastHsvRange_ = selectedHsvRange_;
-                cv::setTrackbarPos("Hmin", "HSVTrackbars", hsvRanges_[selectedHsvRange_].hmin);
-                cv::setTrackbarPos("Hmax", "HSVTrackbars", hsvRanges_[selectedHsvRange_].hmax);
-                cv::setTrackbarPos("Smin", "HSVTrackbars", hsvRanges_[selectedHsvRange_].smin);
-                cv::setTrackbarPos("Smax", "HSVTrackbars", hsvRanges_[selectedHsvRange_].smax);
-                cv::setTrackbarPos("Vmin", "HSVTrackbars", hsvRanges_[selectedHsvRange_].vmin);
-                cv::setTrackbarPos("Vmax", "HSVTrackbars", hsvRanges_[selectedHsvRange_].vmax);
+                cv::setTrackbarPos("Hmin", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].hmin);
+                cv::setTrackbarPos("Hmax", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].hmax);
+                cv::setTrackbarPos("Smin", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].smin);
+                cv::setTrackbarPos("Smax", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].smax);
+                cv::setTrackbarPos("Vmin", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].vmin);
+                cv::setTrackbarPos("Vmax", "HSVTrackbars", detector_.ranges()[selectedHsvRange_].vmax);
             }
 
-            hsvRanges_[selectedHsvRange_].hmin = cv::getTrackbarPos("Hmin", "HSVTrackbars");
-            hsvRanges_[selectedHsvRange_].hmax = cv::getTrackbarPos("Hmax", "HSVTrackbars");
-            hsvRanges_[selectedHsvRange_].smin = cv::getTrackbarPos("Smin", "HSVTrackbars");
-            hsvRanges_[selectedHsvRange_].smax = cv::getTrackbarPos("Smax", "HSVTrackbars");
-            hsvRanges_[selectedHsvRange_].vmin = cv::getTrackbarPos("Vmin", "HSVTrackbars");
-            hsvRanges_[selectedHsvRange_].vmax = cv::getTrackbarPos("Vmax", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].hmin = cv::getTrackbarPos("Hmin", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].hmax = cv::getTrackbarPos("Hmax", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].smin = cv::getTrackbarPos("Smin", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].smax = cv::getTrackbarPos("Smax", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].vmin = cv::getTrackbarPos("Vmin", "HSVTrackbars");
+            detector_.ranges()[selectedHsvRange_].vmax = cv::getTrackbarPos("Vmax", "HSVTrackbars");
 
             updiffh_ = cv::getTrackbarPos("updiffh", "HSVTrackbars")/100.0;
             updiffs_ = cv::getTrackbarPos("updiffs", "HSVTrackbars")/100.0;
@@ -511,27 +540,26 @@ private:
     ros::NodeHandle nh_;
     ros::Subscriber pcl_sub_;
     image_transport::ImageTransport it_;
-    image_transport::Subscriber img_sub_;
     image_transport::Publisher img_pub_;
     tf::TransformListener tf_sub_;
     ros::Publisher imgPosition_pub_;
-    bool haveImage_;
-    bool havePcl_;
-    std_msgs::Header currentheader_;
+    ros::Publisher objects_pub_;
+    bool pipelined_;
+    bool multiObject_;
+    double maxRate_;
     double voxelsize_;
-    double areaMinThreshold_ , areaMaxThreshold_;
     double updiffh_, updiffs_, updiffv_, lowdiffh_, lowdiffs_, lowdiffv_;
-    int rectPadding_;
-    int rows_, cols_;
     int selectedHsvRange_;
     int lastHsvRange_;
-    int heightCorrection_;
     int hmin_, smin_, vmin_, hmax_, smax_, vmax_;
-    Eigen::Vector4f cbMin_, cbMax_;
-    std::vector<hsvRange> hsvRanges_;
 
-    Cloud::Ptr currentCloudPtr_;
-    cv_bridge::CvImagePtr currentImagePtr_;
+    stage_profiler profiler_;
+    profiler_reporter reporter_;
+    latest_mailbox<detection_frame> frames_;
+    boost::thread detectionThread_;
+    detector_params params_;
+    object_detector detector_;
+    std::vector<detected_object> objects_;
 
 #ifdef DCB
     ros::Publisher pcl_tf_pub_;
@@ -542,10 +570,39 @@ private:
 
 
 
+#ifdef OBJECT_RECOGNITION_NODELET
+namespace object_recognition {
+    //object_detection in a nodelet manager. Without the pipelined mode a timer
+    //detects at 5 Hz like the loop of the node does.
+    class detection_nodelet : public nodelet::Nodelet {
+    private:
+        void onInit() {
+            detection_.reset(new object_detection(getNodeHandle()));
+            if(!detection_->pipelined()) {
+                timer_ = getNodeHandle().createTimer(ros::Duration(0.2), &detection_nodelet::detect, this);
+            }
+        }
+
+        void detect(const ros::TimerEvent&) {
+            detection_->detect();
+        }
+
+        boost::scoped_ptr<object_detection> detection_;
+        ros::Timer timer_;
+    };
+}
+PLUGINLIB_EXPORT_CLASS(object_recognition::detection_nodelet, nodelet::Nodelet)
+#else
 int main(int argc, char** argv){
     ros::init(argc, argv, "object_detection");
     object_detection od;
 
+    if(od.pipelined()) {
+        //detect() runs on its own thread, this one only handles the callbacks
+        ros::spin();
+        return 0;
+    }
+
     ros::Rate rate(5);
     while(ros::ok()) {
         ros::spinOnce();
@@ -554,4 +611,4 @@ int main(int argc, char** argv){
     }
 
 }
-
+#endif
@@ -3,9 +3,9 @@
 #include <iostream>
 #include <map>
 #include <ostream>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 #include <std_msgs/String.h>
-#include <dirent.h>
-#include <sys/types.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/core/core.hpp>
@@ -22,48 +22,212 @@
 #include <image_transport/image_transport.h>
 
 #include <actionlib/server/simple_action_server.h>
+#ifdef OBJECT_RECOGNITION_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+#include <object_recognition/labeledSample.h>
+#include <object_recognition/object_classifier.h>
+#include <object_recognition/bounded_queue.h>
+#include <object_recognition/decision_engine.h>
+#include <object_recognition/result_cache.h>
+#include <object_recognition/latest_mailbox.h>
+#include <object_recognition/atomic_value.h>
+#include <object_recognition/stage_profiler.h>
+#include <object_recognition/profiler_reporter.h>
 using std::cout;
 using std::endl;
 
 #define D(X) X
 
-class object_recognition {
+//A crop with what the detection said about it, in the order the callbacks got them
+struct recognition_job {
+    recognition_job() : sequence(0), queued(0) { std::fill_n(point, 3, 0.0f); }
+
+    unsigned long sequence;
+    cv::Mat image;
+    //Owns the data of image when it points into a received message
+    cv_bridge::CvImageConstPtr source;
+    std::string color;
+    float point[3];
+    std_msgs::Header header;
+    //Tick count when it was queued
+    int64 queued;
+};
+
+//What a worker made of a job. Dropped jobs get an output too, marked skipped,
+//so the ones behind them do not wait for it.
+struct recognition_output {
+    recognition_output() : skipped(true), cached(false) {}
+
+    recognition_job job;
+    classification_result classified;
+    //The crop at evidence size
+    cv::Mat showimage;
+    bool skipped;
+    //classified came from the result cache
+    bool cached;
+};
+
+//Named apart from the object_recognition namespace of the package's messages.
+//Runs as its own node or as a nodelet next to object_detection, see the bottom.
+class recognition_node {
 public:
-    object_recognition() :
+    explicit recognition_node(const ros::NodeHandle& handle = ros::NodeHandle()) :
+        nh(handle),
+        reporter(nh, profiler, "object_recognition"),
         _it(nh),
       server(nh, "object_recognition", false){
-        img_path_sub = nh.subscribe("/object_recognition/imgpath", 1, &object_recognition::imgFileCB, this);
-        imagedir = "/home/ras/catkin_ws/src/object_recognition/sample_images/";
-        //img_sub = _it.subscribe("/object_detection/object",1, &object_recognition::recognitionCB,this);
-        imgposition_sub = nh.subscribe("/object_detection/object_position",1, &object_recognition::recognitionCBpos,this);
+        setupProfiler();
+        img_path_sub = nh.subscribe("/object_recognition/imgpath", 1, &recognition_node::imgFileCB, this);
+        nh.param<std::string>("object_recognition/imagedir", imagedir, "/home/ras/catkin_ws/src/object_recognition/sample_images/");
+        //img_sub = _it.subscribe("/object_detection/object",1, &recognition_node::recognitionCB,this);
+        imgposition_sub = nh.subscribe("/object_detection/object_position",1, &recognition_node::recognitionCBpos,this);
         espeak_pub= nh.advertise<std_msgs::String>("/espeak/string",1);
         objectposition_pub = nh.advertise<robot_msgs::detectedObject>("/object_recognition/detected_object",1);
-        cv::namedWindow("Image_got_from_detection");
+        //Headless: no HighGUI at all, for robots without an X server
+        nh.param("object_recognition/headless", headless, false);
+        if(!headless) {
+            cv::namedWindow("Image_got_from_detection");
+        }
         lastobject= ros::Time::now();
         evidence_pub = nh.advertise<ras_msgs::RAS_Evidence>("/evidence",1);
         std::fill_n(alreadyseen,10,0);
-        std::fill_n(lastobjects,2,0);
         std::fill_n(Point,3,0);
-        working=false;
-        train_knn();
-        server.registerGoalCallback(boost::bind(&object_recognition::goworking, this));
-        server.registerPreemptCallback(boost::bind(&object_recognition::stopworking, this));
+        working.store(false);
+        restart.store(false);
+        nextJob=0;
+        nextResult=0;
+        classifier_params params;
+        nh.param<std::string>("object_recognition/pcafile", params.pcaFile, "/home/ras/catkin_ws/src/object_recognition/launch/pca.yml");
+        //Rebuilt on its own when the images in imagedir change, empty to always train
+        nh.param<std::string>("object_recognition/modelfile", params.modelFile, "/home/ras/catkin_ws/src/object_recognition/launch/model.bin");
+        nh.param("object_recognition/loaderthreads", params.loaderThreads, 0);
+        //Compare changes to these with recognition_benchmark first
+        double pcaAccuracy;
+        nh.param("object_recognition/neighborcount", params.neighborCount, 7);
+        nh.param("object_recognition/samplewidth", params.sampleWidth, 100);
+        nh.param("object_recognition/sampleheight", params.sampleHeight, 100);
+        nh.param("object_recognition/pcaaccuracy", pcaAccuracy, 0.99);
+        nh.param("object_recognition/blursize", params.blurSize, 9);
+        params.pcaAccuracy = pcaAccuracy;
+        //full decomposes the whole covariance, truncated only computes the retained components
+        nh.param<std::string>("object_recognition/pcatrainer", params.pcaTrainer, "full");
+        nh.param("object_recognition/fusedpreprocess", params.fusedPreprocess, false);
+        //bruteforce and vptree are exact, hnsw is approximate but faster on large training sets.
+        //The vptree prunes little at the hundreds of dimensions the PCA keeps, benchmark it first.
+        nh.param<std::string>("object_recognition/index/type", params.index.type, "bruteforce");
+        nh.param("object_recognition/index/hnswM", params.index.hnswM, 16);
+        nh.param("object_recognition/index/hnswEfConstruction", params.index.hnswEfConstruction, 100);
+        nh.param("object_recognition/index/hnswEfSearch", params.index.hnswEfSearch, 64);
+        nh.param("object_recognition/index/quantized", params.index.quantized, false);
+        //Color histogram stage, the PCA and the KNN search only run when it is not sure
+        double shapeWeight, acceptDistance, margin;
+        nh.param("object_recognition/cascade/enabled", params.cascade.enabled, false);
+        nh.param("object_recognition/cascade/huebins", params.cascade.hueBins, 18);
+        nh.param("object_recognition/cascade/saturationbins", params.cascade.saturationBins, 4);
+        nh.param("object_recognition/cascade/minsaturation", params.cascade.minSaturation, 60);
+        nh.param("object_recognition/cascade/shapeweight", shapeWeight, 0.25);
+        nh.param("object_recognition/cascade/acceptdistance", acceptDistance, 0.5);
+        nh.param("object_recognition/cascade/margin", margin, 1.5);
+        params.cascade.shapeWeight = shapeWeight;
+        params.cascade.acceptDistance = acceptDistance;
+        params.cascade.margin = margin;
+        //Results of recent crops, reused for the same object at the same place
+        result_cache_params cacheParams;
+        double positionBucket;
+        nh.param("object_recognition/cache/enabled", cacheParams.enabled, false);
+        nh.param("object_recognition/cache/capacity", cacheParams.capacity, 32);
+        nh.param("object_recognition/cache/ttl", cacheParams.ttl, 1.0);
+        nh.param("object_recognition/cache/maxhashdistance", cacheParams.maxHashDistance, 6);
+        nh.param("object_recognition/cache/positionbucket", positionBucket, 0.05);
+        cacheParams.positionBucket = positionBucket;
+        cache.configure(cacheParams);
+        ROS_INFO("Distance kernel: %s", distanceKernel());
+        params.loadPca = load;
+        params.savePca = save;
+        classifier.configure(params);
+        if(!classifier.train(imagedir)) {
+            ROS_ERROR("Could not train on %s", imagedir.c_str());
+        }
+        D(std::cout<< "Training succeded"<< std::endl;)
+        //How the classifications of consecutive crops are fused into a decision, see decision_engine.h
+        decision_params decisionParams;
+        double minVotes, confirmConfidence, agreement;
+        nh.param<std::string>("object_recognition/decision/type", decisionParams.type, "confidence");
+        nh.param("object_recognition/decision/confirmations", decisionParams.confirmations, 3);
+        nh.param("object_recognition/decision/window", decisionParams.window, 5);
+        nh.param("object_recognition/decision/minvotes", minVotes, double(surenessfactor));
+        nh.param("object_recognition/decision/confirmconfidence", confirmConfidence, 0.8);
+        nh.param("object_recognition/decision/agreement", agreement, 0.6);
+        decisionParams.minVotes = minVotes;
+        decisionParams.confirmConfidence = confirmConfidence;
+        decisionParams.agreement = agreement;
+        engine.reset(decision_engine::create(decisionParams));
+        if(!engine) {
+            ROS_ERROR("Unknown decision type %s, deciding on consecutive labels", decisionParams.type.c_str());
+            decisionParams.type = "consecutive";
+            engine.reset(decision_engine::create(decisionParams));
+        }
+        //The workers classify the crops, the callbacks only queue them. A full queue
+        //drops its oldest crop, so the workers stay on the latest ones.
+        int workerCount, queueSize;
+        nh.param("object_recognition/workers", workerCount, 2);
+        nh.param("object_recognition/queuesize", queueSize, 4);
+        jobs.reset(new bounded_queue<recognition_job>(std::max(1, queueSize)));
+        for(int i = 0; i < std::max(1, workerCount); ++i) {
+            workers.create_thread(boost::bind(&recognition_node::workerLoop, this));
+        }
+        //Online learning: labeled crops on /object_recognition/learn are added right
+        //away, the PCA is updated in the background once they stop coming
+        nh.param("object_recognition/learn", learning, false);
+        if(learning) {
+            learn_sub = nh.subscribe("/object_recognition/learn", 10, &recognition_node::learnCB, this);
+            learnThread = boost::thread(&recognition_node::learnLoop, this);
+        }
+        server.registerGoalCallback(boost::bind(&recognition_node::goworking, this));
+        server.registerPreemptCallback(boost::bind(&recognition_node::stopworking, this));
         server.start();
+        reporter.start();
+    }
+
+    ~recognition_node() {
+        jobs->close();
+        workers.join_all();
+        if(learning) {
+            learnThread.interrupt();
+            learnThread.join();
+        }
+    }
+
+    bool isHeadless() const { return headless; }
+
+    //Shows the latest blurred crop, HighGUI is only used from the thread that calls this
+    void showLatest() {
+        boost::scoped_ptr<cv::Mat> image(display.waitTake(boost::posix_time::milliseconds(100)));
+        if(image) {
+            cv::imshow("Image_got_from_detection", *image);
+        }
+        cv::waitKey(1);
     }
 
 
 // ########################## Callbacks #############################
     void goworking(){
-        working=true;
+        working.store(true);
 	std::cout << "Got the comand to start working from main node " << std::endl;
         server.acceptNewGoal();
         //ros::Rate rate(1);
 
-        std::fill_n(lastobjects,2,0);
+        //The engine belongs to the workers, the next result resets it. Not locking here
+        //keeps the action server's lock and resultsMutex apart.
+        restart.store(true);
+        //The new goal gets fresh classifications, not those of the last one
+        cache.clear();
         //server.setSucceeded();
     }
     void stopworking(){
-        working=false;
+        working.store(false);
         server.setPreempted();
     }
 
@@ -72,10 +236,28 @@ public:
         cv::Mat inputImg = cv::imread(pathToImg.data);
         D(cout << "Loading Image done" << endl;)
         cv::cvtColor(inputImg,inputImg,CV_HSV2BGR);
-        classification(inputImg);
+        submit(inputImg);
 
 
 
+    }
+    void learnCB(const object_recognition::labeledSample& sample_msg){
+        cv_bridge::CvImagePtr cv_ptr;
+        try {
+            cv_ptr = cv_bridge::toCvCopy(sample_msg.image, "bgr8");
+        }
+        catch (cv_bridge::Exception& e) {
+            ROS_ERROR("cv_bridge exception: %s", e.what());
+            return;
+        }
+        if(sample_msg.label.empty() || !classifier.addSample(cv_ptr->image, sample_msg.label, learnContext)) {
+            ROS_WARN("Could not learn a sample of %s", sample_msg.label.c_str());
+            return;
+        }
+        profiler.count(learnedCounter);
+        //The cached results may be what the sample corrects
+        cache.clear();
+        D(cout << "Learned a sample of " << sample_msg.label << endl;)
     }
 // For Normal Images:
     void recognitionCB(const sensor_msgs::ImageConstPtr& img_msg){
@@ -91,18 +273,23 @@ public:
             return;
         }
         //cout<< "loaded pointer"<< endl;
-        if(working){
-        classification(cv_ptr->image);
+        if(working.load()){
+        submit(cv_ptr->image);
         }
     }
 // For Images with Poistion:
-    void recognitionCBpos(const robot_msgs::imagePosition& img_msg){
+    //In the same process as object_detection the message is the one it published,
+    //nothing is serialized, and the crop is used in place as long as it is bgr8
+    void recognitionCBpos(const robot_msgs::imagePositionConstPtr& img_ptr){
+        const robot_msgs::imagePosition& img_msg = *img_ptr;
 
         //cout<< "got in CB"<< endl;
+        profiler.count(receivedCounter);
 
-        cv_bridge::CvImagePtr cv_ptr;
+        cv_bridge::CvImageConstPtr cv_ptr;
         try {
-            cv_ptr = cv_bridge::toCvCopy(img_msg.image, "bgr8");
+            stage_profiler::scope decodeScope(profiler, decodeStage);
+            cv_ptr = cv_bridge::toCvShare(img_msg.image, img_ptr, "bgr8");
         }
         catch (cv_bridge::Exception& e) {
             ROS_ERROR("cv_bridge exception: %s", e.what());
@@ -115,55 +302,154 @@ public:
         Point[2]=img_msg.point.z;
         //cout<< "loaded pointer"<< endl;
         currentheader_= img_msg.header;
-        if(working){
-            classification(cv_ptr->image);
+        if(working.load()){
+            submit(cv_ptr->image, cv_ptr);
+        } else {
+            profiler.count(skippedCounter);
         }
 }
  // ########################### Classification ##############################
-    void classification(cv::Mat inputImg){
-        cv::Mat showimage;
-        cv::resize(inputImg,showimage,cv::Size(200,200));
-
-        cv::cvtColor(inputImg,inputImg,CV_BGR2HSV);
-
-
-        //Bluring
-        cv::medianBlur(inputImg, inputImg, 9);
-
-        cv::imshow("Image_got_from_detection",inputImg);
-        cv::waitKey(1);
-        cv::resize(inputImg,inputImg,cv::Size(sample_size_x,sample_size_y),cv::INTER_AREA);
-        cv::Mat rowImg = matToFloatRow(inputImg);
-
+    //Queues a crop with the latest color and position. Callbacks are called by one
+    //spinner thread, so nextJob needs no lock. The crop is only read from then on,
+    //source keeps it alive if it is not its own.
+    void submit(const cv::Mat& inputImg, const cv_bridge::CvImageConstPtr& source = cv_bridge::CvImageConstPtr()){
+        recognition_job job;
+        job.sequence = nextJob++;
+        job.image = inputImg;
+        job.source = source;
+        job.color = color;
+        std::copy(Point, Point + 3, job.point);
+        job.header = currentheader_;
+        job.queued = cv::getTickCount();
+        recognition_job dropped;
+        if(jobs->push(job, dropped)) {
+            profiler.count(droppedCounter);
+            recognition_output output;
+            output.job.sequence = dropped.sequence;
+            finish(output);
+        }
+    }
 
-        //PCA:
-        cv::Mat pcaRowImg;
-        pca.project(rowImg,pcaRowImg);
+    void workerLoop(){
+        //Each worker classifies with its own buffers, the trained classifier is shared
+        classification_context context;
+        recognition_job job;
+        while(jobs->pop(job)){
+            recognition_output output;
+            output.job = job;
+            classification(context, output);
+            finish(output);
+        }
+    }
 
-        cv::Mat res;
-        //cout<< "Before PCA attributes " << rowImg.cols << "After PCA attributes " << pcaRowImg.cols << endl;
+    void classification(classification_context& context, recognition_output& output){
+        const cv::Mat& inputImg = output.job.image;
+        const bool profiling = profiler.enabled();
+        if(profiling) {
+            profiler.record(queueStage, (cv::getTickCount() - output.job.queued) * 1000.0 / cv::getTickFrequency());
+        }
+        cv::resize(inputImg,output.showimage,cv::Size(200,200));
+
+        stage_profiler::scope classifyScope(profiler, classifyStage);
+        output.skipped = false;
+        result_key key;
+        const double now = cv::getTickCount() / cv::getTickFrequency();
+        if(cache.params().enabled) {
+            key = cache.key(inputImg, output.job.color, output.job.point);
+            if(cache.lookup(key, now, output.classified)) {
+                profiler.count(cacheHitCounter);
+                output.cached = true;
+                return;
+            }
+            profiler.count(cacheMissCounter);
+        }
+        context.timing = profiling;
+        classifier.classify(inputImg, output.job.color, output.classified, context);
+        if(cache.params().enabled) {
+            cache.insert(key, now, output.classified);
+        }
+        if(profiling) {
+            const classification_timings& t = context.timings;
+            profiler.record(preprocessStage, t.preprocess);
+            profiler.record(cascadeStage, t.cascade);
+            if(output.classified.cascade) {
+                profiler.count(cascadedCounter);
+            } else {
+                profiler.record(projectionStage, t.projection);
+                profiler.record(knnStage, t.knn);
+            }
+            profiler.count(classifiedCounter);
+        }
+        if(!headless) {
+            display.put(new cv::Mat(context.blurredImage.clone()));
+        }
+    }
 
-        cv::Mat neighborsclasses;
-        cv::Mat neighborsdistant;
-        kc.find_nearest(pcaRowImg, neighborcount, res,neighborsclasses,neighborsdistant);
-        //float resbayes = bc.predict(pcaRowImg);
+    //Updates the PCA with the learned samples once no new one came for a second,
+    //the workers classify with the old basis until the new one is swapped in
+    void learnLoop(){
+        int seen = 0;
+        while(true) {
+            try {
+                boost::this_thread::sleep(boost::posix_time::seconds(1));
+                const int added = classifier.addedSamples();
+                if(added > 0 && added == seen) {
+                    stage_profiler::scope updateScope(profiler, updateStage);
+                    classifier.updateModel();
+                    cache.clear();
+                    seen = 0;
+                } else {
+                    seen = added;
+                }
+            } catch(boost::thread_interrupted&) {
+                return;
+            }
+        }
+    }
 
-        int sureness=0;
-        for(int i=0;i<neighborcount;i++){
-            if(res.at<int>(0)==neighborsclasses.at<int>(0,i)){
-                sureness++;
+    //Takes the output of any worker and decides on the outputs in the order
+    //their crops came in, as far as they are complete
+    void finish(const recognition_output& output){
+        boost::lock_guard<boost::mutex> lock(resultsMutex);
+        pending[output.job.sequence] = output;
+        std::map<unsigned long, recognition_output>::iterator next;
+        while((next = pending.find(nextResult)) != pending.end()) {
+            if(!next->second.skipped) {
+                decide(next->second);
             }
+            pending.erase(next);
+            ++nextResult;
+        }
+    }
+
+    //Called in order with resultsMutex held
+    void decide(const recognition_output& output){
+        //Crops queued before the last goal finished
+        if(!working.load()){
+            profiler.count(skippedCounter);
+            return;
+        }
+        if(restart.exchange(false)){
+            engine->reset();
         }
-        //D(cout << "Amount of yes votes " << sureness << "  Out of "<< neighborcount<< endl;)
+        //A cache hit repeats an earlier classification, it is no new evidence for the engine
+        if(output.cached){
+            return;
+        }
+        const classification_result& classified = output.classified;
+        const float* Point = output.job.point;
+        const cv::Mat& showimage = output.showimage;
+
+        //D(cout << "Amount of yes votes " << classified.votes << "  Out of "<< neighborcount<< endl;)
         //D(cout << "K-Nearest neighbor said : " << intToDesc[res.at<float>(0)] << "  <<" Given color: "<< color << endl;)
-        int resultid = res.at<float>(0);
+        int resultid = classified.label;
         std::string result;
         //std::string resultbayes = intToDesc[resbayes];
-        std::string resultkn =intToDesc[resultid];
+        std::string resultkn =classified.name;
         ros::Time time = ros::Time::now();
-        int matchingcolorkn = resultkn.find(color);
+        //The classifier checked the name against the color of the detection
         //int matchingcolorbayes = resultbayes.find(color);
-        if(matchingcolorkn >=0){
+        if(classified.colorConsistent){
             result= resultkn;
             //D(std::cout << "All 2 have agreed" << std::endl;)
         }
@@ -191,8 +477,18 @@ public:
             resultid=-1;
         }
         if(0!=result.compare(("background")) && result.size()>0){
-            if(lastobjects[0]==resultid && lastobjects[1]==resultid){
+            decision decided;
+            //With resultid -1 the engine gives the frame no confidence, classified is about another label
+            if(engine->add(resultid, classified, output.job.queued / cv::getTickFrequency(), decided)){
+                //From the arrival of the first crop of the object to now
+                const double decisionMs = (cv::getTickCount() / cv::getTickFrequency() - decided.firstTime) * 1000.0;
+                profiler.record(decisionStage, decisionMs);
+                profiler.count(decidedCounter);
+                profiler.count(decisionFramesCounter, decided.frames);
+                D(std::cout << "Decided after " << decided.frames << " frames, " << decisionMs << " ms, confidence " << decided.confidence << std::endl;)
                 if(resultid!=-1) alreadyseen[resultid]++;
+                stage_profiler::scope publishScope(profiler, publishStage);
+                profiler.count(publishedCounter);
                 // Publishing Msg:
                 D(std::cout << "Detected an " << result << std::endl;)
                 robot_msgs::detectedObject detection_msgs;
@@ -200,7 +496,7 @@ public:
                 detection_msgs.position.y= Point[1];
                 detection_msgs.position.z= Point[2];
                 detection_msgs.object_id = result;
-                detection_msgs.header = currentheader_;
+                detection_msgs.header = output.job.header;
                 objectposition_pub.publish(detection_msgs);
                 // Publishing Evidence
                 ras_msgs::RAS_Evidence evidence_msg;
@@ -214,14 +510,10 @@ public:
                 evidence_pub.publish(evidence_msg);
                 speakresult(result);
                 lastobject = time;
-                working=false;
+                working.store(false);
                 server.setSucceeded();
 
                 }
-            else{
-                lastobjects[1]=lastobjects[0];
-                lastobjects[0]=resultid;
-            }
         }
         /*else if(time.sec-lastobject.sec >5 ){
             ras_msgs::RAS_Evidence msg;
@@ -239,117 +531,41 @@ public:
 
 
 
- //############################## Train functions ####################################
-
-    void trainPCA(cv::Mat& rowImg, cv::Mat& result){
-        if(load){
-            cv::FileStorage fs1("/home/ras/catkin_ws/src/object_recognition/launch/pca.yml", cv::FileStorage::READ);
-            cv::Mat loadeigenvectors, loadeigenvalues , loadedmean;
-            fs1["Eigenvalues"] >> loadeigenvalues;
-            fs1["Eigenvector"] >> loadeigenvectors;
-            fs1["Mean"] >> loadedmean;
-            fs1.release();
-            pca.mean=loadedmean.clone();
-            pca.eigenvalues= loadeigenvalues.clone();
-            pca.eigenvectors=loadeigenvectors.clone();
-            pca.project(rowImg,result);
-            std::cout << "Loaded succesfull! Cols left : " << result.cols << std::endl;
-        }
-        else{
-            std::cout << " Rows before PCA " << rowImg.cols << std::endl;
-            pca = cv::PCA(rowImg,cv::Mat(), CV_PCA_DATA_AS_ROW,pcaaccuracy);
-            pca.project(rowImg,result);
-
-            std::cout << " Rows after PCA " << result.cols << std::endl;
-            if(save){
-                cv::FileStorage fs("/home/ras/catkin_ws/src/object_recognition/launch/pca.yml", cv::FileStorage::WRITE);
-
-                cv::Mat eigenval,eigenvec,mean;
-                mean=pca.mean.clone();
-                eigenval=pca.eigenvalues.clone();
-                eigenvec=pca.eigenvectors.clone();
-                fs << "Eigenvalues" << eigenval;
-                fs << "Eigenvector" << eigenvec;
-                fs << "Mean" << mean;
-                fs.release();
-
-            }
-        }
-    }
-
-    void train_BayesClassifier(cv::Mat& traindata,cv::Mat& responses){
-        bc.train(traindata,responses);
-    }
-
-    void train_knn(){
-        std::vector<std::pair<std::string, std::vector<std::string> > > objects = readTestImagePaths(imagedir);
-        cv::Mat trainData;
-        cv::Mat responses;
-        for(int i = 0; i < objects.size(); i++) {
-            cout << objects[i].first << " = " << i << endl;
-            intToDesc[i] = objects[i].first;
-            std::vector<std::string>& vec = objects[i].second;
-            for(int j = 0; j < vec.size(); j++) {
-                responses.push_back(i);
-                cv::Mat inputImg = cv::imread(imagedir + objects[i].first + "/" + vec[j]);
-                cv::Mat rowImg = matToFloatRow(inputImg);
-                trainData.push_back(rowImg);
-            }
-        }
-        cv::Mat pcatrainData;
-        trainPCA(trainData,pcatrainData);
-        D(std::cout << "Try to train"<< std::endl;)
-        kc.train(pcatrainData, responses);
-
-        //BayesClassifier:
-        //train_BayesClassifier(pcatrainData,responses);
-
-        D(std::cout<< "Training succeded"<< std::endl;)
-    }
-
-
-    std::vector<std::pair<std::string, std::vector<std::string> > >
-    readTestImagePaths(std::string directory) {
-        std::vector<std::pair<std::string, std::vector<std::string> > > objects;
-        DIR* dirPtr;
-        dirent* entry;
-
-        if((dirPtr = opendir(directory.c_str())) == NULL) {
-            cout << "Could not open directory for training";
-            return objects;
-        }
-
-        entry = readdir(dirPtr);
-        while(entry != NULL) {
-            if(entry->d_type == DT_DIR && entry->d_name[0] != '.') objects.push_back(make_pair(entry->d_name, std::vector<std::string>()));
-            entry = readdir(dirPtr);
-        }
-        closedir(dirPtr);
-        for(int i = 0; i < objects.size(); i++) {
-            dirPtr = opendir((directory + objects[i].first).c_str());
-            entry = readdir(dirPtr);
-            while(entry != NULL) {
-                if(entry->d_type != DT_DIR) objects[i].second.push_back(entry->d_name);
-                entry = readdir(dirPtr);
-            }
-        }
-
-        return objects;
-    }
 // ############################### Help Functions ##############################
-    cv::Mat matToFloatRow(const cv::Mat& input) {
-        cv::Mat res(1, input.rows*input.cols*attributes, CV_32FC1);
-        int rows = input.rows;
-        int cols = input.cols;
-        for(int x=0; x < rows; x++){
-            for (int y=0; y<cols; y++){
-                res.at<float>(0,((x*cols + y)*attributes))      = float(input.at<cv::Vec3b>(x,y)[0]);
-                //res.at<float>(0,((x*cols + y)*attributes + 1)) = float(input.at<cv::Vec3b>(x,y)[1]);
-                //res.at<float>(0,((x*cols + y)*attributes + 2)) = float(input.at<cv::Vec3b>(x,y)[2]);
-            }
-        }
-        return res;
+    //Stages and counters of the profiler, in the order setupProfiler() adds them
+    enum { decodeStage, queueStage, preprocessStage, projectionStage, knnStage, publishStage, classifyStage, updateStage,
+           decisionStage, cascadeStage };
+    enum { receivedCounter, droppedCounter, skippedCounter, classifiedCounter, publishedCounter, learnedCounter,
+           decidedCounter, decisionFramesCounter, cascadedCounter, cacheHitCounter, cacheMissCounter };
+
+    void setupProfiler() {
+        profiler.addStage("decode");
+        profiler.addStage("queue");
+        profiler.addStage("preprocess");
+        profiler.addStage("projection");
+        profiler.addStage("knn");
+        profiler.addStage("publish");
+        profiler.addStage("classify");
+        profiler.addStage("update");
+        //Time to decision
+        profiler.addStage("decision");
+        profiler.addStage("cascade");
+        profiler.addCounter("received");
+        profiler.addCounter("dropped");
+        profiler.addCounter("skipped");
+        profiler.addCounter("classified");
+        profiler.addCounter("published");
+        profiler.addCounter("learned");
+        profiler.addCounter("decided");
+        //Frames the decisions needed, divided by decided the mean frames to decision
+        profiler.addCounter("decisionframes");
+        //Crops the cascade answered without the PCA and the KNN search
+        profiler.addCounter("cascaded");
+        //Crops answered from the result cache and those that were classified
+        profiler.addCounter("cachehits");
+        profiler.addCounter("cachemisses");
     }
+
     void speakresult(std::string detectedobject){
         std::stringstream ss;
 
@@ -361,39 +577,90 @@ public:
 
 private:
     std::string color;
-    int lastobjects[2];
     int alreadyseen[10];
     float Point[3];
-    cv::PCA pca;
     ros::Publisher espeak_pub , evidence_pub, objectposition_pub;
     ros::NodeHandle nh;
-    ros::Subscriber img_path_sub, imgposition_sub;
+    ros::Subscriber img_path_sub, imgposition_sub, learn_sub;
     static const float surenessfactor = 0.5;
-    static const int neighborcount= 7;
-    static const int sample_size_x = 100;
-    static const int sample_size_y = 100;
-    static const int attributes = 1;
-    static const float pcaaccuracy = 0.99;
     static const bool save= false;
     static const bool load= true;
-    std::map<int, std::string> intToDesc;
     std::string imagedir;
-    cv::KNearest kc;
-    cv::NormalBayesClassifier bc;
+    bool headless;
+    object_classifier classifier;
+    result_cache cache;
+    stage_profiler profiler;
+    profiler_reporter reporter;
     image_transport::ImageTransport _it;
     image_transport::Subscriber img_sub;
     ros::Time lastobject;
     std_msgs::Header currentheader_;
-    bool working;
+    atomic_value<bool> working, restart;
+    //Used by decide() only
+    boost::scoped_ptr<decision_engine> engine;
     actionlib::SimpleActionServer<robot_msgs::recognitionActionAction> server;
+    boost::scoped_ptr<bounded_queue<recognition_job> > jobs;
+    boost::thread_group workers;
+    unsigned long nextJob;
+    //Outputs that finished ahead of an earlier one, by sequence
+    boost::mutex resultsMutex;
+    std::map<unsigned long, recognition_output> pending;
+    unsigned long nextResult;
+    //Latest blurred crop for showLatest()
+    latest_mailbox<cv::Mat> display;
+    bool learning;
+    //learnCB() runs on the spinner thread
+    classification_context learnContext;
+    boost::thread learnThread;
 };
 
 
+#ifdef OBJECT_RECOGNITION_NODELET
+namespace object_recognition {
+    //recognition_node in a nodelet manager. getNodeHandle() calls the callbacks on
+    //one thread at a time like the spinner of the node does. HighGUI gets its own thread.
+    class recognition_nodelet : public nodelet::Nodelet {
+    public:
+        ~recognition_nodelet() {
+            if(displayThread_.joinable()) {
+                displayThread_.interrupt();
+                displayThread_.join();
+            }
+        }
+
+    private:
+        void onInit() {
+            node_.reset(new recognition_node(getNodeHandle()));
+            if(!node_->isHeadless()) {
+                displayThread_ = boost::thread(&recognition_nodelet::displayLoop, this);
+            }
+        }
+
+        void displayLoop() {
+            while(ros::ok()) {
+                boost::this_thread::interruption_point();
+                node_->showLatest();
+            }
+        }
+
+        boost::scoped_ptr<recognition_node> node_;
+        boost::thread displayThread_;
+    };
+}
+PLUGINLIB_EXPORT_CLASS(object_recognition::recognition_nodelet, nodelet::Nodelet)
+#else
 int main(int argc, char** argv){
     ros::init(argc, argv, "object_recognition");
-    object_recognition object_rec;
-    ros::Rate rate(1);
+    recognition_node object_rec;
+    //One thread keeps the callbacks in order, the workers do the classification
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+    if(object_rec.isHeadless()){
+        ros::waitForShutdown();
+        return 0;
+    }
     while(ros::ok()){
-        ros::spinOnce();
+        object_rec.showLatest();
     }
 }
+#endif
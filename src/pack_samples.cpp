@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <opencv2/highgui/highgui.hpp>
+#include <object_recognition/object_classifier.h>
+#include <object_recognition/sample_pack.h>
+
+//Packs training images into one sample pack, see sample_pack.h. The pack can be
+//given to object_recognition as imagedir and to replay_benchmark as --train or --images.
+//
+//Usage: pack_samples [--append] pack dir...
+//  pack        output file, replaced unless --append is given
+//  dir         images like sample_images/, one subdirectory per label.
+//              The images are stored as they are, in HSV.
+//  --append    add to an existing pack, a label that is already in it is merged
+
+int main(int argc, char** argv) {
+    bool append = false;
+    std::vector<std::string> args;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--append")) append = true;
+        else args.push_back(argv[i]);
+    }
+    if(args.size() < 2) {
+        printf("usage: pack_samples [--append] pack dir...\n");
+        return 1;
+    }
+    const std::string packPath = args[0];
+    if(!append) {
+        remove(packPath.c_str());
+    }
+
+    sample_pack_writer writer;
+    bool opened = false;
+    int added = 0, skipped = 0;
+    for(size_t d = 1; d < args.size(); ++d) {
+        std::string dir = args[d];
+        if(dir[dir.size() - 1] != '/') dir += "/";
+        const object_classifier::image_paths objects = object_classifier::readTestImagePaths(dir);
+        for(size_t i = 0; i < objects.size(); ++i) {
+            const std::vector<std::string>& files = objects[i].second;
+            for(size_t j = 0; j < files.size(); ++j) {
+                const std::string path = dir + objects[i].first + "/" + files[j];
+                //Some samples have no extension, imread goes by the contents
+                const cv::Mat image = cv::imread(path);
+                if(image.empty()) {
+                    printf("could not read %s\n", path.c_str());
+                    ++skipped;
+                    continue;
+                }
+                //An existing pack keeps its size, a new one takes the size of the first image
+                if(!opened) {
+                    opened = (append && writer.open(packPath, 0, 0)) || writer.open(packPath, image.cols, image.rows);
+                    if(!opened) {
+                        printf("could not open %s for %dx%d samples\n", packPath.c_str(), image.cols, image.rows);
+                        return 1;
+                    }
+                }
+                if(!writer.add(objects[i].first, image)) {
+                    printf("skipped %s, it is %dx%d and the pack %dx%d\n", path.c_str(), image.cols, image.rows,
+                           writer.width(), writer.height());
+                    ++skipped;
+                    continue;
+                }
+                ++added;
+            }
+        }
+    }
+    if(!writer.close()) {
+        printf("could not write %s\n", packPath.c_str());
+        return 1;
+    }
+    sample_pack pack;
+    if(!pack.open(packPath)) {
+        printf("no samples packed\n");
+        return 1;
+    }
+    printf("added %d, skipped %d, %s holds %d samples of %d labels\n", added, skipped, packPath.c_str(),
+           pack.size(), int(pack.labelNames().size()));
+    return 0;
+}